@@ -7,13 +7,60 @@
 #define STL_ALLOCATOR
 #define BOTH_ALLOC_USED
 #define ARRAY_TEST
+#define REMOTE_FREE_TEST
+#define BATCH_TEST
+#define PMR_TEST
+#define OBJECT_POOL_TEST
+#define CHUNK_RETENTION_TEST
+#define HUGE_PAGES_BENCHMARK
+#define LARGE_OBJ_ARENAS_BENCHMARK
+#define LOCK_FREE_FIXED_ALLOCATOR_TEST
+#define EPOCH_RECLAIM_TEST
+#define USABLE_SIZE_TEST
+#define LARGE_ALIGNMENT_TEST
+#define COROUTINE_FRAME_TEST
+#define SHARED_MEMORY_HEAP_TEST
+#define PERSISTENT_HEAP_TEST
+#define LATENCY_BENCHMARK
+#define METADATA_OVERHEAD_BENCHMARK
+#define MULTI_THREADED_BENCHMARK
+#define CACHE_LINE_ISOLATION_TEST
+#define CHUNK_COLOURING_BENCHMARK
 
 #include <iostream>
 #include "ShirosMemoryManager.h"
 #include "ShirosSTLAllocator.h"
+#include "ShirosMemoryResource.h"
+#include "ObjectPool.h"
+#include "LockFreeFixedAllocator.h"
+#include "EpochReclaimer.h"
+#include "CoroutineFrameAllocator.h"
+#include "SharedMemoryHeap.h"
+#include "PersistentHeap.h"
+#include "CacheLineAllocator.h"
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+#include <list>
+#include <map>
 #include <ctime>
 #include <chrono>
 #include <cassert>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 #ifdef GLOBAL_OP_OVERLOAD
 #define GLOBAL_SHIRO_MM
@@ -22,6 +69,8 @@
 
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
 using std::chrono::seconds;
 using std::chrono::system_clock;
 
@@ -68,6 +117,21 @@ void SmallObjAllocPerformanceTest(ShirosMemoryManager& Instance)
 	Instance.PrintMemoryState();
 	cout << "ShirosMemoryManager takes :" << std::to_string((float)delta / 1000) << " to complete" << endl; //convert to seconds
 
+	PointersToSmallObjTest.clear();
+	start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	for (int i = 0; i < TestSize; ++i)
+	{
+		SmallObjTest* ptr = MM_NEW_T(SmallObjTest)();
+		PointersToSmallObjTest.push_back(ptr);
+	}
+	for (int i = 0; i < TestSize; ++i)
+	{
+		MM_DELETE_T(PointersToSmallObjTest[i]);
+	}
+	end_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	delta = end_millisec - start_millisec;
+	cout << "ShirosMemoryManager with compile-time size class takes :" << std::to_string((float)delta / 1000) << " to complete" << endl; //convert to seconds
+
 	std::vector<SmallObjTest*> PointersToSmallObjTest2;
 
 	start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
@@ -180,8 +244,1408 @@ void CheckStandardBehavior()
 	cout << "====== END OF STANDARD BEHAVIOR TEST ======" << endl;
 }
 
-int main()
+void CheckRemoteFree()
+{
+	cout << "====== REMOTE FREE TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+
+	constexpr int TestSize = 1000;
+	constexpr int ArrayLength = 4;
+	std::vector<SmallObjTest*> SmallObjects;
+	std::vector<LargeObjTest*> LargeObjects;
+	std::vector<SmallObjTest*> SmallArrays;
+	std::vector<LargeObjTest*> LargeArrays;
+	SmallObjects.reserve(TestSize);
+	LargeObjects.reserve(TestSize);
+	SmallArrays.reserve(TestSize);
+	LargeArrays.reserve(TestSize);
+
+	const size_t UsedBefore = Instance.GetCurrentlyUsedMemory();
+	const size_t RequestedBefore = Instance.GetMemoryRequested();
+	const size_t FreedBefore = Instance.GetMemoryFreed();
+	const size_t ArraysBefore = Instance.GetArrayAllocationsCount();
+
+	//producer: the owner thread allocates
+	for (int i = 0; i < TestSize; ++i)
+	{
+		SmallObjects.push_back(MM_NEW(alignof(SmallObjTest)) SmallObjTest());
+		LargeObjects.push_back(MM_NEW(alignof(LargeObjTest)) LargeObjTest());
+		SmallArrays.push_back(MM_NEW_A(SmallObjTest, ArrayLength));
+		LargeArrays.push_back(MM_NEW_A(LargeObjTest, ArrayLength));
+	}
+	assert(Instance.GetArrayAllocationsCount() == ArraysBefore + 2 * TestSize);
+	Instance.PrintMemoryState();
+
+	//consumer: a foreign thread releases, without any lock. Arrays are released without their size
+	std::thread Consumer([&]() {
+		for (int i = 0; i < TestSize; ++i)
+		{
+			MM_DELETE(SmallObjects[i], sizeof(SmallObjTest));
+			MM_DELETE(LargeObjects[i], sizeof(LargeObjTest));
+			MM_DELETE_A(SmallArrays[i], ArrayLength);
+			MM_DELETE_A(LargeArrays[i], ArrayLength);
+		}
+	});
+	Consumer.join();
+
+	//the owner gives back the handed over blocks and erases their array map entries.
+	//the consumer thread state is allocated and freed as well, every byte requested must come back
+	assert(Instance.GetArrayAllocationsCount() == ArraysBefore);
+	assert(Instance.GetMemoryFreed() - FreedBefore == Instance.GetMemoryRequested() - RequestedBefore);
+	assert(Instance.GetCurrentlyUsedMemory() == UsedBefore);
+	Instance.PrintMemoryState();
+
+	cout << "====== END OF REMOTE FREE TEST ======" << endl;
+}
+
+void CheckBatchAllocation()
+{
+	cout << "====== BATCH ALLOCATION TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+
+	constexpr size_t TestSize = 1000;
+	void* SmallObjects[TestSize];
+	void* LargeObjects[16];
+
+	Instance.PrintMemoryState();
+	size_t Allocated = Instance.AllocateBatch(sizeof(SmallObjTest), TestSize, SmallObjects, alignof(SmallObjTest));
+	assert(Allocated == TestSize && "Small objects batch allocation failed");
+	Allocated = Instance.AllocateBatch(sizeof(LargeObjTest), 16, LargeObjects, alignof(LargeObjTest));
+	assert(Allocated == 16 && "Large objects batch allocation failed");
+	Instance.PrintMemoryState();
+	
+	Instance.DeallocateBatch(SmallObjects, TestSize, sizeof(SmallObjTest));
+	Instance.DeallocateBatch(LargeObjects, 16, sizeof(LargeObjTest));
+	Instance.PrintMemoryState();
+
+	//foreign threads batch objects of any size straight from the arenas
+	const size_t UsedBefore = Instance.GetCurrentlyUsedMemory();
+	std::thread Worker([&Instance, &SmallObjects, &LargeObjects]() {
+		size_t WorkerAllocated = Instance.AllocateBatch(sizeof(LargeObjTest), 16, LargeObjects, alignof(LargeObjTest));
+		assert(WorkerAllocated == 16 && "Large objects batch allocation failed on a foreign thread");
+		Instance.DeallocateBatch(LargeObjects, WorkerAllocated, sizeof(LargeObjTest));
+		WorkerAllocated = Instance.AllocateBatch(sizeof(SmallObjTest), 16, SmallObjects, alignof(SmallObjTest));
+		assert(WorkerAllocated == 16 && "Small objects batch allocation failed on a foreign thread");
+		Instance.DeallocateBatch(SmallObjects, WorkerAllocated, sizeof(SmallObjTest));
+		void* Single = Instance.Allocate(sizeof(SmallObjTest), ShirosMemoryManager::AllocationType::Single, alignof(SmallObjTest));
+		assert(Single && "Small object allocation failed on a foreign thread");
+		Instance.Deallocate(Single, sizeof(SmallObjTest));
+	});
+	Worker.join();
+	assert(Instance.GetCurrentlyUsedMemory() == UsedBefore);
+
+	cout << "====== END OF BATCH ALLOCATION TEST ======" << endl;
+}
+
+void CheckMemoryResources()
+{
+	cout << "====== MEMORY RESOURCES TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+	Instance.PrintMemoryState();
+
+	{
+		//containers backed by the Memory Manager, deallocation is sized
+		std::pmr::vector<SmallObjTest> Vector(&ShirosMemoryResource::Get());
+		std::pmr::string String("a string long enough to skip small string optimization", &ShirosMemoryResource::Get());
+		for (int i = 0; i < 100; ++i)
+		{
+			Vector.push_back(SmallObjTest());
+		}
+		Instance.PrintMemoryState();
+
+		//map nodes served by a single size class, buckets forwarded upstream
+		ShirosPoolResource Pool(64);
+		std::pmr::unordered_map<int, SmallObjTest> Map(&Pool);
+		for (int i = 0; i < 100; ++i)
+		{
+			Map[i] = SmallObjTest();
+		}
+
+		//strings bumped out of an arena and released all at once
+		ShirosArenaResource Arena;
+		std::pmr::vector<std::pmr::string> Strings(&Arena);
+		for (int i = 0; i < 100; ++i)
+		{
+			Strings.emplace_back("arena allocated string number " + std::to_string(i));
+		}
+		Instance.PrintMemoryState();
+	}
+
+	Instance.PrintMemoryState();
+	cout << "====== END OF MEMORY RESOURCES TEST ======" << endl;
+}
+
+void CheckObjectPool()
+{
+	cout << "====== OBJECT POOL TEST ======" << endl;
+
+	constexpr size_t TestSize = 1000;
+	ObjectPool<SmallObjTest> Pool(true /*KeepWarm*/);
+	SmallObjTest* Objects[TestSize];
+
+	const size_t Created = Pool.CreateBatch(Objects, TestSize, SmallObjTest{ 1, 2.f, 3.f, 4 });
+	assert(Created == TestSize && Pool.GetLiveCount() == TestSize && "Bulk construction failed");
+
+	//release half of them, they stay warm
+	for (size_t i = 0; i < TestSize; i += 2)
+	{
+		Pool.Destroy(Objects[i]);
+	}
+	assert(Pool.GetLiveCount() == TestSize / 2 && Pool.GetWarmCount() == TestSize / 2);
+
+	long long Sum = 0;
+	Pool.ForEach([&Sum](SmallObjTest& Obj) { Sum += Obj.a; });
+	assert(Sum == TestSize / 2 && "Iteration must visit only live objects");
+
+	//warm objects come back as they were left
+	SmallObjTest* Warm = Pool.Reuse();
+	assert(Warm->a == 1 && Pool.GetWarmCount() == TestSize / 2 - 1);
+	Pool.Destroy(Warm);
+
+	cout << "Live objects: " << Pool.GetLiveCount() << " Warm objects: " << Pool.GetWarmCount() << " Memory: " << Pool.GetTotalAllocatedMemory() << endl;
+	cout << "====== END OF OBJECT POOL TEST ======" << endl;
+}
+
+/** When AfterIdle is given, the allocator is left idle past maxIdleMs and trimmed before its stats are taken again */
+size_t RunChunkRetentionWorkload(const ChunkRetentionPolicy& Retention, ChunkStats* AfterIdle = nullptr)
+{
+	constexpr size_t BlockSize = sizeof(SmallObjTest);
+	constexpr size_t BlocksInFlight = 5 * (DEFAULT_CHUNK_SIZE / BlockSize); //a few chunks worth of blocks
+	FixedAllocator Allocator(DEFAULT_CHUNK_SIZE, BlockSize, FixedAllocator::FreeTracking::FREE_LIST, Retention);
+	void* Blocks[BlocksInFlight];
+
+	//grow and shrink around the same chunk count, as a frame based workload would
+	for (int Round = 0; Round < 1000; ++Round)
+	{
+		for (size_t i = 0; i < BlocksInFlight; ++i)
+		{
+			Blocks[i] = Allocator.Allocate();
+		}
+		for (size_t i = 0; i < BlocksInFlight; ++i)
+		{
+			Allocator.Deallocate(Blocks[i]);
+		}
+	}
+
+	const ChunkStats Stats = Allocator.GetChunkStats();
+	cout << "Chunks created: " << Stats.created << " destroyed: " << Stats.destroyed << " live: " << Stats.live << " empty: " << Stats.empty << endl;
+	if (AfterIdle)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(Retention.maxIdleMs + 50));
+		Allocator.TrimEmptyChunks();
+		*AfterIdle = Allocator.GetChunkStats();
+		cout << "After idle trim, destroyed: " << AfterIdle->destroyed << " live: " << AfterIdle->live << " empty: " << AfterIdle->empty << endl;
+		assert(AfterIdle->destroyed == Stats.destroyed + Stats.empty && "Every chunk idle past maxIdleMs must be released");
+	}
+	Allocator.Release();
+	return Stats.created;
+}
+
+void CheckChunkRetention()
+{
+	cout << "====== CHUNK RETENTION TEST ======" << endl;
+
+	ChunkRetentionPolicy KeepOne;
+	cout << "Keep one empty chunk: ";
+	const size_t KeepOneCreated = RunChunkRetentionWorkload(KeepOne);
+
+	ChunkRetentionPolicy Watermark;
+	Watermark.mode = ChunkRetentionPolicy::Mode::WATERMARK;
+	Watermark.highWatermark = 8;
+	Watermark.lowWatermark = 4;
+	cout << "Watermark 8/4: ";
+	const size_t WatermarkCreated = RunChunkRetentionWorkload(Watermark);
+	assert(WatermarkCreated < KeepOneCreated && "Watermark policy must avoid chunk churn");
+
+	ChunkRetentionPolicy Idle;
+	Idle.mode = ChunkRetentionPolicy::Mode::TIME_BASED;
+	Idle.maxIdleMs = 100;
+	cout << "Released after 100ms idle: ";
+	ChunkStats IdleStats;
+	RunChunkRetentionWorkload(Idle, &IdleStats);
+	assert(IdleStats.empty == 0 && IdleStats.destroyed > 0 && "Time based policy must release idle chunks on TrimEmptyChunks");
+
+	cout << "====== END OF CHUNK RETENTION TEST ======" << endl;
+}
+
+/** Counts data TLB misses of the calling thread where the platform exposes them, Linux perf events only */
+class TlbMissCounter
+{
+public:
+	TlbMissCounter()
+	{
+#ifdef __linux__
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+	~TlbMissCounter()
+	{
+#ifdef __linux__
+		if (m_fd >= 0) close(m_fd);
+#endif
+	}
+
+	inline bool IsAvailable() const { return m_fd >= 0; }
+
+	void Start()
+	{
+#ifdef __linux__
+		if (!IsAvailable()) return;
+		ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	long long Stop()
+	{
+		long long misses = -1;
+#ifdef __linux__
+		if (!IsAvailable()) return misses;
+		ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(m_fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+#endif
+		return misses;
+	}
+
+private:
+	int m_fd = -1;
+};
+
+/** Random pointer chase over nodes scattered in a whole FreeListAllocator pool: every hop is likely a TLB miss with 4KB pages */
+void RunPointerChase(bool HugePages)
+{
+	struct ChaseNode
+	{
+		ChaseNode* next;
+		char payload[56];
+	};
+
+	constexpr size_t PoolSize = 67108864; // 64 MB
+	constexpr size_t NodesCount = 500000;
+	constexpr size_t Hops = 20000000;
+
+	FreeListAllocator Pool(PoolSize, FreeListAllocator::FitPolicy::FIRST_FIT, HugePages);
+	std::vector<ChaseNode*> Nodes(NodesCount);
+	for (size_t i = 0; i < NodesCount; ++i)
+	{
+		size_t AllocationSize;
+		Nodes[i] = static_cast<ChaseNode*>(Pool.Allocate(sizeof(ChaseNode), alignof(ChaseNode), AllocationSize));
+	}
+
+	//link nodes in a random cycle
+	std::shuffle(Nodes.begin(), Nodes.end(), std::mt19937(42));
+	for (size_t i = 0; i < NodesCount; ++i)
+	{
+		Nodes[i]->next = Nodes[(i + 1) % NodesCount];
+	}
+
+	TlbMissCounter TlbMisses;
+	TlbMisses.Start();
+	auto start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	ChaseNode* Node = Nodes[0];
+	for (size_t i = 0; i < Hops; ++i)
+	{
+		Node = Node->next;
+	}
+	auto end_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	const long long Misses = TlbMisses.Stop();
+	volatile ChaseNode* LastNode = Node; //keep the chase observable
+	(void)LastNode;
+	long long delta = end_millisec - start_millisec;
+
+	cout << (HugePages ? "Huge pages (" : "Default pages (") << PageAllocator::ToString(Pool.GetPageBacking()) << "): ";
+	cout << Hops << " hops in " << delta << " ms, ";
+	cout << (delta > 0 ? Hops / delta : Hops) << " hops/ms, dTLB misses: ";
+	if (Misses >= 0) cout << Misses; else cout << "n/a";
+	cout << endl;
+	//nodes are dropped with the whole pool
+}
+
+void HugePagesBenchmark()
+{
+	cout << "====== HUGE PAGES BENCHMARK ======" << endl;
+	RunPointerChase(false);
+	RunPointerChase(true);
+	cout << "====== END OF HUGE PAGES BENCHMARK ======" << endl;
+}
+
+/** Every thread keeps a window of live 1-16KB blocks, releasing the oldest one at each new allocation. Returns operations per ms */
+long long RunLargeObjArenasWorkload(LargeObjArenas& Arenas, size_t ThreadsCount)
+{
+	constexpr size_t Iterations = 100000;
+	constexpr size_t Window = 64;
+
+	auto Worker = [&Arenas]() {
+		void* Live[Window] = {};
+		for (size_t i = 0; i < Iterations; ++i)
+		{
+			void*& Slot = Live[i % Window];
+			if (Slot) Arenas.Deallocate(Slot);
+
+			size_t AllocationSize;
+			Slot = Arenas.Allocate(1024 + (i * 7919) % (15 * 1024), alignof(std::max_align_t), AllocationSize);
+			assert(Slot);
+		}
+		for (size_t i = 0; i < Window; ++i)
+		{
+			if (Live[i]) Arenas.Deallocate(Live[i]);
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	auto start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	auto end_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	long long delta = end_millisec - start_millisec;
+
+	const long long Operations = static_cast<long long>(2 * Iterations * ThreadsCount);
+	return delta > 0 ? Operations / delta : Operations;
+}
+
+void LargeObjArenasBenchmark()
+{
+	cout << "====== LARGE OBJECT ARENAS BENCHMARK ======" << endl;
+
+	const size_t MaxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+	constexpr size_t PoolSize = 268435456; // 256 MB
+
+	for (size_t ThreadsCount = 1; ThreadsCount <= MaxThreads; ThreadsCount *= 2)
+	{
+		LargeObjArenas SingleArena(PoolSize, 1, FreeListAllocator::FitPolicy::FIRST_FIT);
+		LargeObjArenas PerCpuArenas(PoolSize, 0, FreeListAllocator::FitPolicy::FIRST_FIT);
+		cout << ThreadsCount << " threads: single arena " << RunLargeObjArenasWorkload(SingleArena, ThreadsCount) << " ops/ms, ";
+		cout << PerCpuArenas.GetArenasCount() << " per CPU arenas " << RunLargeObjArenasWorkload(PerCpuArenas, ThreadsCount) << " ops/ms" << endl;
+	}
+
+	cout << "====== END OF LARGE OBJECT ARENAS BENCHMARK ======" << endl;
+}
+
+void CheckLockFreeFixedAllocator()
+{
+	cout << "====== LOCK FREE FIXED ALLOCATOR TEST ======" << endl;
+
+	constexpr size_t ThreadsCount = 4;
+	constexpr size_t Iterations = 200000;
+	constexpr size_t Window = 32;
+	LockFreeFixedAllocator Allocator(sizeof(SmallObjTest));
+
+	//every thread stamps its blocks: a block handed out twice would be overwritten by another thread
+	auto Worker = [&Allocator](long long Stamp) {
+		SmallObjTest* Live[Window] = {};
+		for (size_t i = 0; i < Iterations; ++i)
+		{
+			SmallObjTest*& Slot = Live[i % Window];
+			if (Slot)
+			{
+				assert(Slot->a == Stamp && "Block shared by two threads");
+				Allocator.Deallocate(Slot);
+			}
+			Slot = static_cast<SmallObjTest*>(Allocator.Allocate());
+			Slot->a = Stamp;
+		}
+		for (size_t i = 0; i < Window; ++i)
+		{
+			if (Live[i]) Allocator.Deallocate(Live[i]);
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	auto start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		Threads.emplace_back(Worker, static_cast<long long>(t));
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+	auto end_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+	cout << ThreadsCount * Iterations * 2 << " operations in " << end_millisec - start_millisec << " ms, memory: " << Allocator.GetTotalAllocatedMemory() << endl;
+	cout << "====== END OF LOCK FREE FIXED ALLOCATOR TEST ======" << endl;
+}
+
+struct EpochNode
+{
+	std::atomic<EpochNode*> next;
+	long long key;
+	long long check;
+};
+
+void CheckEpochReclaim()
+{
+	cout << "====== EPOCH RECLAIM TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+	EpochReclaimer& Reclaimer = EpochReclaimer::Get();
+
+	constexpr size_t ListLength = 64;
+	constexpr long long Replacements = 200000;
+	constexpr size_t ReadersCount = 3;
+
+	auto NewNode = [&Instance](long long Key, EpochNode* Next) {
+		EpochNode* Node = static_cast<EpochNode*>(Instance.Allocate(sizeof(EpochNode), ShirosMemoryManager::AllocationType::Single, alignof(EpochNode)));
+		Node->next.store(Next, std::memory_order_relaxed);
+		Node->key = Key;
+		Node->check = ~Key;
+		return Node;
+	};
+
+	std::atomic<EpochNode*> Head(nullptr);
+	for (size_t i = 0; i < ListLength; ++i)
+	{
+		Head.store(NewNode(static_cast<long long>(i), Head.load(std::memory_order_relaxed)), std::memory_order_release);
+	}
+
+	//readers walk the list inside a guard: a node they can reach is never handed back meanwhile
+	std::atomic<bool> Done(false);
+	std::atomic<size_t> Traversals(0);
+	auto Reader = [&Head, &Done, &Traversals]() {
+		while (!Done.load(std::memory_order_acquire))
+		{
+			EpochGuard Guard;
+			for (EpochNode* Node = Head.load(std::memory_order_acquire); Node; Node = Node->next.load(std::memory_order_acquire))
+			{
+				assert(Node->check == ~Node->key && "Node reclaimed while still reachable");
+			}
+			Traversals.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	std::vector<std::thread> Readers;
+	for (size_t i = 0; i < ReadersCount; ++i)
+	{
+		Readers.emplace_back(Reader);
+	}
+
+	//the owner is the only writer: it replaces the head and retires the unlinked node
+	for (long long i = 0; i < Replacements; ++i)
+	{
+		EpochNode* Old = Head.load(std::memory_order_relaxed);
+		Head.store(NewNode(ListLength + i, Old->next.load(std::memory_order_relaxed)), std::memory_order_release);
+		Reclaimer.Retire(Old, sizeof(EpochNode));
+	}
+
+	Done.store(true, std::memory_order_release);
+	for (std::thread& Thread : Readers)
+	{
+		Thread.join();
+	}
+
+	for (EpochNode* Node = Head.exchange(nullptr); Node;)
+	{
+		EpochNode* Next = Node->next.load(std::memory_order_relaxed);
+		Reclaimer.Retire(Node, sizeof(EpochNode));
+		Node = Next;
+	}
+	//no reader left, two epoch advances release everything retired so far
+	size_t Reclaimed = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		Reclaimed += Reclaimer.TryReclaim();
+	}
+
+	cout << Traversals.load() << " traversals, epoch " << Reclaimer.GetEpoch() << ", last reclaim gave back " << Reclaimed << " nodes" << endl;
+	Instance.PrintMemoryState();
+	cout << "====== END OF EPOCH RECLAIM TEST ======" << endl;
+}
+
+void CheckUsableSize()
+{
+	cout << "====== USABLE SIZE TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+
+	const size_t Sizes[] = { 3, 24, 129, 1000, 4097 };
+	for (size_t Size : Sizes)
+	{
+		const ShirosMemoryManager::AllocationResult Res = Instance.AllocateAtLeast(Size, 64);
+		assert(Res.ptr && Res.count >= Size);
+		assert(Instance.UsableSize(Res.ptr, Size) == Res.count);
+		std::memset(Res.ptr, 0xAB, Res.count); //the whole capacity belongs to the caller
+		cout << "Requested " << Size << " bytes, usable " << Res.count << endl;
+		Instance.Deallocate(Res.ptr, Res.count);
+	}
+
+	auto Res = ShirosSTLAllocator<int>().allocate_at_least(37);
+	cout << "allocate_at_least(37) ints returned room for " << Res.count << endl;
+	ShirosSTLAllocator<int>().deallocate(Res.ptr, Res.count);
+
+	Instance.PrintMemoryState();
+	cout << "====== END OF USABLE SIZE TEST ======" << endl;
+}
+
+void CheckLargeAlignment()
+{
+	cout << "====== LARGE ALIGNMENT TEST ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+
+	struct AlignedRequest { size_t Size; size_t Alignment; };
+	const AlignedRequest Requests[] = { { 64, 4096 }, { 1000, 256 }, { 4096, 4096 }, { 10000, 65536 }, { 100000, 2 * 1024 * 1024 } };
+	constexpr size_t RequestsCount = sizeof(Requests) / sizeof(Requests[0]);
+	void* Blocks[RequestsCount];
+
+	//interleave every aligned request with a small large block, so each one must skip past a misaligned address
+	void* Spacers[RequestsCount];
+	for (size_t i = 0; i < RequestsCount; ++i)
+	{
+		Spacers[i] = Instance.Allocate(200, ShirosMemoryManager::AllocationType::Single);
+		const size_t UsedBefore = Instance.GetCurrentlyUsedMemory();
+		Blocks[i] = Instance.Allocate(Requests[i].Size, ShirosMemoryManager::AllocationType::Single, Requests[i].Alignment);
+		assert(Blocks[i] && reinterpret_cast<size_t>(Blocks[i]) % Requests[i].Alignment == 0);
+		cout << "Size " << Requests[i].Size << " aligned to " << Requests[i].Alignment << " accounted " << Instance.GetCurrentlyUsedMemory() - UsedBefore << " bytes" << endl;
+	}
+
+	//leading remainders went back to the pool: further requests are served from them
+	void* Refill = Instance.Allocate(1000, ShirosMemoryManager::AllocationType::Single);
+	assert(Refill);
+
+	Instance.Deallocate(Refill, 1000);
+	for (size_t i = 0; i < RequestsCount; ++i)
+	{
+		Instance.Deallocate(Blocks[i], Requests[i].Size);
+		Instance.Deallocate(Spacers[i], 200);
+	}
+	Instance.PrintMemoryState();
+	cout << "====== END OF LARGE ALIGNMENT TEST ======" << endl;
+}
+
+#if defined(COROUTINE_FRAME_TEST) && defined(__cpp_impl_coroutine)
+/** Minimal lazy task: the frame lives from the call until the task object is destroyed */
+template <typename Allocation>
+struct FrameTask
+{
+	struct promise_type : Allocation
+	{
+		long long value = 0;
+
+		FrameTask get_return_object() { return FrameTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_value(long long Value) { value = Value; }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	explicit FrameTask(std::coroutine_handle<promise_type> Handle) : handle(Handle) {}
+	FrameTask(FrameTask&& Other) noexcept : handle(Other.handle) { Other.handle = nullptr; }
+	FrameTask(const FrameTask&) = delete;
+	FrameTask& operator=(const FrameTask&) = delete;
+	~FrameTask() { if (handle) handle.destroy(); }
+
+	long long Run() { handle.resume(); return handle.promise().value; }
+};
+
+/** Frames through the generic Memory Manager entry points, as global operator new would route them */
+struct MemoryManagerFrameAllocation
+{
+	static void* operator new(std::size_t size) { return ShirosMemoryManager::Get().Allocate(size, ShirosMemoryManager::AllocationType::Single); }
+	static void operator delete(void* ptr, std::size_t size) noexcept { ShirosMemoryManager::Get().Deallocate(ptr, size); }
+};
+
+template <typename Allocation>
+FrameTask<Allocation> Accumulate(long long a, long long b)
+{
+	long long Local[8] = { a, b }; //gives the frame a realistic size
+	co_return Local[0] + Local[1];
+}
+
+template <typename Allocation>
+long long RunCoroutines(size_t Count)
+{
+	long long Sum = 0;
+	auto start_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	for (size_t i = 0; i < Count; ++i)
+	{
+		FrameTask<Allocation> Task = Accumulate<Allocation>(static_cast<long long>(i), 1);
+		Sum += Task.Run();
+	}
+	auto end_millisec = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	cout << Count << " coroutines in " << end_millisec - start_millisec << " ms" << endl;
+	return Sum;
+}
+
+void CoroutineFrameTest()
+{
+	cout << "====== COROUTINE FRAME TEST ======" << endl;
+
+	constexpr size_t Count = 1000000;
+	cout << "Memory Manager: ";
+	const long long Expected = RunCoroutines<MemoryManagerFrameAllocation>(Count);
+	cout << "CoroutineFrameAllocator: ";
+	const long long Sum = RunCoroutines<CoroutineFrameAllocation>(Count);
+	assert(Sum == Expected);
+
+	//frames destroyed by another thread land in its cache and go back to the shared class allocator on exit
+	std::vector<FrameTask<CoroutineFrameAllocation>> Tasks;
+	for (size_t i = 0; i < 1000; ++i)
+	{
+		Tasks.push_back(Accumulate<CoroutineFrameAllocation>(1, 1));
+	}
+	std::thread Consumer([&Tasks]() {
+		for (FrameTask<CoroutineFrameAllocation>& Task : Tasks)
+		{
+			Task.Run();
+		}
+		Tasks.clear();
+	});
+	Consumer.join();
+
+	cout << "Frame allocator memory: " << CoroutineFrameAllocator::Get().GetTotalAllocatedMemory() << endl;
+	cout << "====== END OF COROUTINE FRAME TEST ======" << endl;
+}
+#endif
+
+void CheckSharedMemoryHeap()
+{
+	cout << "====== SHARED MEMORY HEAP TEST ======" << endl;
+
+	const char* Name = "/shiro_shared_heap_test";
+	SharedMemoryHeap::Remove(Name); //leftover of an interrupted run
+	SharedMemoryHeap Producer(Name, 16 * 1024 * 1024);
+	//a second mapping of the same segment, at another address, as a consumer process would see it
+	SharedMemoryHeap Consumer(Name);
+	if (!Producer.IsValid() || !Consumer.IsValid())
+	{
+		SharedMemoryHeap::Remove(Name);
+		cout << "====== END OF SHARED MEMORY HEAP TEST ======" << endl;
+		return;
+	}
+
+	//the producer builds messages in place and publishes only their offsets
+	constexpr size_t MessagesCount = 1000;
+	std::vector<SharedMemoryHeap::Offset> Offsets;
+	for (size_t i = 0; i < MessagesCount; ++i)
+	{
+		const uint64_t Length = 1024 + i * 16;
+		unsigned char* Message = static_cast<unsigned char*>(Producer.Allocate(sizeof(uint64_t) + Length));
+		assert(Message);
+		std::memcpy(Message, &Length, sizeof(Length));
+		std::memset(Message + sizeof(Length), static_cast<int>(i & 0xFF), Length);
+		Offsets.push_back(Producer.ToOffset(Message));
+	}
+	void* Page = Producer.Allocate(4096, 4096);
+	assert(reinterpret_cast<size_t>(Consumer.FromOffset(Producer.ToOffset(Page))) % 4096 == 0);
+	cout << "Producer mapping " << static_cast<void*>(Producer.FromOffset<unsigned char>(Offsets[0])) << ", consumer mapping " << static_cast<void*>(Consumer.FromOffset<unsigned char>(Offsets[0]))
+		<< ", used " << Producer.GetUsedMemory() << " bytes" << endl;
+
+	//the consumer reads every message through its own mapping, with no copy, and gives it back
+	for (size_t i = 0; i < MessagesCount; ++i)
+	{
+		unsigned char* Message = Consumer.FromOffset<unsigned char>(Offsets[i]);
+		uint64_t Length;
+		std::memcpy(&Length, Message, sizeof(Length));
+		assert(Length == 1024 + i * 16);
+		assert(Message[sizeof(Length) + Length - 1] == static_cast<unsigned char>(i & 0xFF));
+		Consumer.Deallocate(Message);
+	}
+	Consumer.Deallocate(Consumer.FromOffset(Producer.ToOffset(Page)));
+	assert(Producer.GetUsedMemory() == 0);
+
+	cout << "After consumption used " << Producer.GetUsedMemory() << " bytes" << endl;
+	SharedMemoryHeap::Remove(Name);
+	cout << "====== END OF SHARED MEMORY HEAP TEST ======" << endl;
+}
+
+/** Sorted key/value index stored in a PersistentHeap, entries are reached by offset */
+struct PersistentIndex
+{
+	struct Entry
+	{
+		uint64_t key;
+		uint64_t value;
+	};
+
+	uint64_t count;
+	SharedMemoryHeap::Offset entries;
+};
+
+/** Opens the heap at Path, building the index only when the heap was not restored. Returns the value sum of the index */
+uint64_t OpenPersistentIndex(const char* Path, size_t EntriesCount)
+{
+	auto start_microsec = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	PersistentHeap Heap(Path, 64 * 1024 * 1024);
+	assert(Heap.IsValid());
+
+	PersistentIndex* Index = Heap.GetRoot<PersistentIndex>(0);
+	if (!Heap.WasRestored() || !Index)
+	{
+		Index = static_cast<PersistentIndex*>(Heap.Allocate(sizeof(PersistentIndex)));
+		PersistentIndex::Entry* Entries = static_cast<PersistentIndex::Entry*>(Heap.Allocate(EntriesCount * sizeof(PersistentIndex::Entry)));
+		std::mt19937_64 Generator(42);
+		for (size_t i = 0; i < EntriesCount; ++i)
+		{
+			Entries[i] = { Generator(), i };
+		}
+		std::sort(Entries, Entries + EntriesCount, [](const PersistentIndex::Entry& lhs, const PersistentIndex::Entry& rhs) { return lhs.key < rhs.key; });
+		Index->count = EntriesCount;
+		Index->entries = Heap.ToOffset(Entries);
+		Heap.SetRoot(0, Index);
+	}
+
+	const PersistentIndex::Entry* Entries = Heap.FromOffset<PersistentIndex::Entry>(Index->entries);
+	uint64_t Sum = 0;
+	for (uint64_t i = 0; i < Index->count; ++i)
+	{
+		Sum += Entries[i].value;
+	}
+	auto end_microsec = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+
+	cout << (Heap.WasRestored() ? "Restored" : "Built") << " index of " << Index->count << " entries in " << end_microsec - start_microsec << " us" << endl;
+	return Sum;
+}
+
+void CheckPersistentHeap()
+{
+	cout << "====== PERSISTENT HEAP TEST ======" << endl;
+
+	const std::string Path = (std::filesystem::temp_directory_path() / "shiro_persistent_heap.bin").string();
+	PersistentHeap::Remove(Path.c_str());
+
+	//first run builds the index, the second one maps it back as the previous run left it
+	constexpr size_t EntriesCount = 1000000;
+	const uint64_t Built = OpenPersistentIndex(Path.c_str(), EntriesCount);
+	const uint64_t Restored = OpenPersistentIndex(Path.c_str(), EntriesCount);
+	assert(Built == Restored);
+
+	//a second user of the same file is turned away while the first one holds it
+	{
+		PersistentHeap Heap(Path.c_str(), 64 * 1024 * 1024);
+		PersistentHeap Intruder(Path.c_str(), 64 * 1024 * 1024, true);
+		assert(Heap.IsValid() && Heap.WasRestored() && !Intruder.IsValid());
+	}
+	PersistentHeap::Remove(Path.c_str());
+
+	//a file that is not a heap is left as it is
+	const char Content[] = "not a heap, long enough to be mistaken for a segment header by a careless reader";
+	if (FILE* File = std::fopen(Path.c_str(), "wb"))
+	{
+		std::fwrite(Content, 1, sizeof(Content), File);
+		std::fclose(File);
+	}
+	{
+		PersistentHeap Heap(Path.c_str(), 64 * 1024 * 1024, true);
+		assert(!Heap.IsValid());
+	}
+	assert(std::filesystem::file_size(Path) == sizeof(Content));
+
+	PersistentHeap::Remove(Path.c_str());
+	cout << "====== END OF PERSISTENT HEAP TEST ======" << endl;
+}
+
+void LatencyBenchmark()
+{
+	cout << "====== LATENCY BENCHMARK ======" << endl;
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+	Instance.ResetLatency();
+	Instance.SetLatencyTracking(true);
+
+	//random live window, so frees hit both fresh and old blocks of every tier
+	struct LiveBlock
+	{
+		void* ptr;
+		size_t size;
+	};
+	constexpr size_t WindowSize = 4096;
+	constexpr size_t Operations = 1000000;
+	std::vector<LiveBlock> Window(WindowSize, LiveBlock{ nullptr, 0 });
+	std::mt19937 Generator(42);
+	std::uniform_int_distribution<size_t> SlotDistribution(0, WindowSize - 1);
+	std::uniform_int_distribution<size_t> KindDistribution(0, 99);
+
+	for (size_t i = 0; i < Operations; ++i)
+	{
+		LiveBlock& Block = Window[SlotDistribution(Generator)];
+		if (Block.ptr)
+		{
+			Instance.Deallocate(Block.ptr, Block.size);
+		}
+
+		//80% small objects, 15% large objects, 5% arrays
+		const size_t Kind = KindDistribution(Generator);
+		if (Kind < 80)
+		{
+			Block.size = 8 + (i % 16) * 8;
+			Block.ptr = Instance.Allocate(Block.size, ShirosMemoryManager::AllocationType::Single);
+		}
+		else if (Kind < 95)
+		{
+			Block.size = 512 + (i % 32) * 128;
+			Block.ptr = Instance.Allocate(Block.size, ShirosMemoryManager::AllocationType::Single);
+		}
+		else
+		{
+			Block.size = 0; //arrays are released through the array map
+			Block.ptr = Instance.Allocate(64 + (i % 64) * 16, ShirosMemoryManager::AllocationType::Collection);
+		}
+	}
+
+	for (LiveBlock& Block : Window)
+	{
+		if (Block.ptr) Instance.Deallocate(Block.ptr, Block.size);
+	}
+
+	Instance.SetLatencyTracking(false);
+	Instance.PrintLatency();
+	cout << "====== END OF LATENCY BENCHMARK ======" << endl;
+}
+
+/** Resident set size of the process in bytes, 0 where it cannot be read */
+size_t GetResidentMemory()
+{
+#ifdef __linux__
+	FILE* statm = std::fopen("/proc/self/statm", "r");
+	if (!statm) return 0;
+	unsigned long long Pages = 0, ResidentPages = 0;
+	const bool Parsed = std::fscanf(statm, "%llu %llu", &Pages, &ResidentPages) == 2;
+	std::fclose(statm);
+	return Parsed ? static_cast<size_t>(ResidentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+	return 0;
+#endif
+}
+
+/** Path of the running client, benchmarks needing a fresh process launch it again */
+const char* g_clientPath = nullptr;
+
+struct MetadataWorkload
+{
+	const char* name;
+	size_t minSize;
+	size_t maxSize;
+	ShirosMemoryManager::AllocationType type;
+};
+const MetadataWorkload MetadataWorkloads[] = {
+	{ "Small 16B", 16, 16, ShirosMemoryManager::AllocationType::Single },
+	{ "Small 8-128B", 8, 128, ShirosMemoryManager::AllocationType::Single },
+	{ "Large 256B-4KB", 256, 4096, ShirosMemoryManager::AllocationType::Single },
+	{ "Arrays 16B-2KB", 16, 2048, ShirosMemoryManager::AllocationType::Collection }
+};
+
+/** 
+ * Keeps Count blocks of a workload live, either from glibc or from the Memory Manager. Run in a process that did nothing else,
+ * so RSS growth counts every page the allocator needs and the whole Memory Manager reservation is charged to the workload
+ */
+void RunMetadataWorkload(size_t WorkloadIndex, size_t Count, bool Glibc)
+{
+	ShirosMemoryManager& Instance = ShirosMemoryManager::Get();
+	assert(WorkloadIndex < sizeof(MetadataWorkloads) / sizeof(MetadataWorkloads[0]));
+	const MetadataWorkload& Load = MetadataWorkloads[WorkloadIndex];
+
+	//bookkeeping containers stay out of the Memory Manager, its footprint is all due to the workload
+	std::mt19937 Generator(7);
+	std::uniform_int_distribution<size_t> SizeDistribution(Load.minSize, Load.maxSize);
+	std::vector<size_t, Mallocator<size_t>> Sizes(Count);
+	std::vector<void*, Mallocator<void*>> Ptrs(Count);
+	size_t Requested = 0;
+	for (size_t& Size : Sizes)
+	{
+		Size = SizeDistribution(Generator);
+		Requested += Size;
+	}
+
+	//every byte is touched so it becomes resident
+	const size_t RssBefore = GetResidentMemory();
+	for (size_t i = 0; i < Count; ++i)
+	{
+		Ptrs[i] = Glibc ? std::malloc(Sizes[i]) : Instance.Allocate(Sizes[i], Load.type);
+		std::memset(Ptrs[i], 1, Sizes[i]);
+	}
+	const long long Rss = static_cast<long long>(GetResidentMemory()) - static_cast<long long>(RssBefore);
+
+	cout << Load.name << ", " << Count << " live blocks, " << Requested << " bytes requested, ";
+	if (Glibc)
+	{
+		cout << "glibc RSS growth " << Rss / 1024 << " KB" << endl;
+	}
+	else
+	{
+		//free reserve included: the large object pool and retained chunks are paid by the only workload of the process
+		const MemoryFootprint Small = Instance.GetSmallObjFootprint();
+		const MemoryFootprint Large = Instance.GetLargeObjFootprint();
+		const size_t ArrayMap = Instance.GetArrayMapFootprint();
+		const long long Overhead = static_cast<long long>(Small.GetReservedBytes() + Large.GetReservedBytes() + ArrayMap) - static_cast<long long>(Requested);
+		const size_t Metadata = Small.metadataBytes + Large.metadataBytes + ArrayMap;
+		cout << "Shiro: " << static_cast<double>(Overhead) / static_cast<double>(Requested) << " overhead bytes per live byte ("
+			<< static_cast<double>(Metadata) / static_cast<double>(Requested) << " metadata), reserved "
+			<< (Small.GetReservedBytes() + Large.GetReservedBytes()) / 1024 << " KB, RSS growth " << Rss / 1024 << " KB" << endl;
+	}
+
+	for (size_t i = 0; i < Count; ++i)
+	{
+		if (Glibc) std::free(Ptrs[i]);
+		else if (Load.type == ShirosMemoryManager::AllocationType::Collection) Instance.Deallocate(Ptrs[i]);
+		else Instance.Deallocate(Ptrs[i], Sizes[i]);
+	}
+}
+
+void MetadataOverheadBenchmark()
+{
+	cout << "====== METADATA OVERHEAD BENCHMARK ======" << endl;
+	const size_t LiveCounts[] = { 1000, 10000 };
+
+	//pages kept by earlier tests would hide what a workload really costs, each run gets a fresh client process
+	for (size_t w = 0; w < sizeof(MetadataWorkloads) / sizeof(MetadataWorkloads[0]); ++w)
+	{
+		for (size_t Count : LiveCounts)
+		{
+			for (const char* Allocator : { "glibc", "shiro" })
+			{
+				const std::string Command = std::string("\"") + g_clientPath + "\" --metadata-workload "
+					+ std::to_string(w) + " " + std::to_string(Count) + " " + Allocator;
+				cout.flush();
+				if (std::system(Command.c_str()) != 0)
+				{
+					cout << "Metadata workload " << MetadataWorkloads[w].name << " failed to run in a fresh process" << endl;
+				}
+			}
+		}
+	}
+
+	cout << "====== END OF METADATA OVERHEAD BENCHMARK ======" << endl;
+}
+
+/** Thread-safe allocator under test. Requests outside minSize and maxSize are not supported from threads other than the main one */
+struct BenchmarkAllocator
+{
+	const char* name;
+	void* (*allocate)(size_t);
+	void (*deallocate)(void*, size_t);
+	size_t minSize;
+	size_t maxSize;
+};
+
+struct SizeDistribution
+{
+	const char* name;
+	size_t minSize;
+	size_t maxSize;
+};
+
+/** xorshift generator, benchmark workers must not allocate */
+inline uint64_t NextRandom(uint64_t& State)
+{
+	State ^= State << 13;
+	State ^= State >> 7;
+	State ^= State << 17;
+	return State;
+}
+
+inline size_t PickSize(const SizeDistribution& Sizes, uint64_t& State)
+{
+	return Sizes.minSize + static_cast<size_t>(NextRandom(State) % (Sizes.maxSize - Sizes.minSize + 1));
+}
+
+/** Spawn ThreadsCount threads running Worker(threadIndex) and wait for them */
+template <typename Func>
+void RunThreads(size_t ThreadsCount, Func&& Worker)
+{
+	std::vector<std::thread> Threads;
+	Threads.reserve(ThreadsCount);
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		Threads.emplace_back(Worker, t);
+	}
+	for (std::thread& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
+template <typename Func>
+long long MeasureOpsPerMs(size_t Operations, Func&& Run)
+{
+	auto start_microsec = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	Run();
+	auto end_microsec = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	const long long delta = end_microsec - start_microsec;
+	return delta > 0 ? static_cast<long long>(Operations) * 1000 / delta : static_cast<long long>(Operations);
+}
+
+/** threadtest: every thread allocates a batch of blocks and frees it, over and over, sharing nothing with the others */
+long long RunThreadtest(const BenchmarkAllocator& Allocator, const SizeDistribution& Sizes, size_t ThreadsCount)
+{
+	constexpr size_t Rounds = 50;
+	constexpr size_t BatchSize = 500;
+
+	auto Worker = [&Allocator, &Sizes](size_t ThreadIndex) {
+		void* Blocks[BatchSize];
+		size_t BlockSizes[BatchSize];
+		uint64_t State = 0x9E3779B97F4A7C15ULL ^ (ThreadIndex + 1);
+		for (size_t r = 0; r < Rounds; ++r)
+		{
+			for (size_t i = 0; i < BatchSize; ++i)
+			{
+				BlockSizes[i] = PickSize(Sizes, State);
+				Blocks[i] = Allocator.allocate(BlockSizes[i]);
+				*static_cast<char*>(Blocks[i]) = 1;
+			}
+			for (size_t i = 0; i < BatchSize; ++i)
+			{
+				Allocator.deallocate(Blocks[i], BlockSizes[i]);
+			}
+		}
+	};
+
+	return MeasureOpsPerMs(2 * Rounds * BatchSize * ThreadsCount, [&]() { RunThreads(ThreadsCount, Worker); });
+}
+
+/** Larson: server style churn. Every round a new set of threads adopts the windows of live blocks left by the previous one, so most frees are cross-thread */
+long long RunLarson(const BenchmarkAllocator& Allocator, const SizeDistribution& Sizes, size_t ThreadsCount)
+{
+	constexpr size_t Rounds = 10;
+	constexpr size_t WindowSize = 500;
+	constexpr size_t StepsPerRound = 5000;
+
+	struct LiveBlock
+	{
+		void* ptr;
+		size_t size;
+	};
+	std::vector<LiveBlock> Windows(ThreadsCount * WindowSize, LiveBlock{ nullptr, 0 });
+
+	const long long OpsPerMs = MeasureOpsPerMs(2 * Rounds * StepsPerRound * ThreadsCount, [&]() {
+		for (size_t r = 0; r < Rounds; ++r)
+		{
+			RunThreads(ThreadsCount, [&, r](size_t ThreadIndex) {
+				LiveBlock* Window = &Windows[((ThreadIndex + r) % ThreadsCount) * WindowSize];
+				uint64_t State = 0x9E3779B97F4A7C15ULL ^ (r * ThreadsCount + ThreadIndex + 1);
+				for (size_t i = 0; i < StepsPerRound; ++i)
+				{
+					LiveBlock& Block = Window[NextRandom(State) % WindowSize];
+					if (Block.ptr) Allocator.deallocate(Block.ptr, Block.size);
+					Block.size = PickSize(Sizes, State);
+					Block.ptr = Allocator.allocate(Block.size);
+					*static_cast<char*>(Block.ptr) = 1;
+				}
+			});
+		}
+	});
+
+	//survivors were allocated by workers, a worker releases them too so remote accounting stays balanced
+	RunThreads(1, [&](size_t) {
+		for (LiveBlock& Block : Windows)
+		{
+			if (Block.ptr) Allocator.deallocate(Block.ptr, Block.size);
+		}
+	});
+	return OpsPerMs;
+}
+
+/** xmalloc: threads are split in producer/consumer pairs, producers allocate and consumers free every block through a ring. Needs an even ThreadsCount */
+long long RunXmalloc(const BenchmarkAllocator& Allocator, const SizeDistribution& Sizes, size_t ThreadsCount)
+{
+	constexpr size_t RingCapacity = 256;
+	constexpr size_t Messages = 50000;
+	assert(ThreadsCount >= 2 && ThreadsCount % 2 == 0);
+	const size_t Pairs = ThreadsCount / 2;
+
+	std::vector<std::atomic<void*>> Rings(Pairs * RingCapacity);
+	std::vector<size_t> RingSizes(Pairs * RingCapacity);
+	for (std::atomic<void*>& Slot : Rings)
+	{
+		Slot.store(nullptr, std::memory_order_relaxed);
+	}
+
+	return MeasureOpsPerMs(2 * Messages * Pairs, [&]() {
+		RunThreads(2 * Pairs, [&](size_t ThreadIndex) {
+			const size_t Pair = ThreadIndex / 2;
+			std::atomic<void*>* Ring = &Rings[Pair * RingCapacity];
+			size_t* SlotSizes = &RingSizes[Pair * RingCapacity];
+			uint64_t State = 0x9E3779B97F4A7C15ULL ^ (Pair + 1);
+			for (size_t m = 0; m < Messages; ++m)
+			{
+				std::atomic<void*>& Slot = Ring[m % RingCapacity];
+				if (ThreadIndex % 2 == 0) //producer
+				{
+					const size_t Size = PickSize(Sizes, State);
+					void* ptr = Allocator.allocate(Size);
+					*static_cast<char*>(ptr) = 1;
+					while (Slot.load(std::memory_order_acquire)) std::this_thread::yield();
+					SlotSizes[m % RingCapacity] = Size;
+					Slot.store(ptr, std::memory_order_release);
+				}
+				else //consumer
+				{
+					void* ptr;
+					while (!(ptr = Slot.load(std::memory_order_acquire))) std::this_thread::yield();
+					const size_t Size = SlotSizes[m % RingCapacity];
+					Slot.store(nullptr, std::memory_order_release);
+					Allocator.deallocate(ptr, Size);
+				}
+			}
+		});
+	});
+}
+
+/** 
+ * Passive false sharing: the main thread allocates a small counter for each thread, then every thread increments only its own.
+ * Counters packed on the same cache line make the line bounce among cores. Returns increments per ms
+ */
+long long RunFalseSharing(const BenchmarkAllocator& Allocator, size_t ThreadsCount, size_t& OutCacheLines)
 {
+	constexpr size_t Increments = 2000000;
+	constexpr size_t CacheLineSize = 64;
+
+	std::vector<std::atomic<uint64_t>*> Counters(ThreadsCount);
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		Counters[t] = new(Allocator.allocate(sizeof(std::atomic<uint64_t>))) std::atomic<uint64_t>(0);
+	}
+
+	std::vector<size_t> Lines(ThreadsCount);
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		Lines[t] = reinterpret_cast<size_t>(Counters[t]) / CacheLineSize;
+	}
+	std::sort(Lines.begin(), Lines.end());
+	OutCacheLines = static_cast<size_t>(std::unique(Lines.begin(), Lines.end()) - Lines.begin());
+
+	const long long OpsPerMs = MeasureOpsPerMs(Increments * ThreadsCount, [&]() {
+		RunThreads(ThreadsCount, [&Counters](size_t ThreadIndex) {
+			std::atomic<uint64_t>& Counter = *Counters[ThreadIndex];
+			for (size_t i = 0; i < Increments; ++i)
+			{
+				Counter.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	});
+
+	for (size_t t = 0; t < ThreadsCount; ++t)
+	{
+		assert(Counters[t]->load() == Increments);
+		Allocator.deallocate(Counters[t], sizeof(std::atomic<uint64_t>));
+	}
+	return OpsPerMs;
+}
+
+void MultiThreadedBenchmark()
+{
+	cout << "====== MULTI THREADED BENCHMARK ======" << endl;
+
+	//threads other than the owner can ask the Memory Manager only for large objects
+	const BenchmarkAllocator Allocators[] = {
+		{ "malloc", [](size_t Size) { return std::malloc(Size); }, [](void* ptr, size_t) { std::free(ptr); }, 0, SIZE_MAX },
+		{ "ShirosMemoryManager", [](size_t Size) { return ShirosMemoryManager::Get().Allocate(Size, ShirosMemoryManager::AllocationType::Single); },
+			[](void* ptr, size_t Size) { ShirosMemoryManager::Get().Deallocate(ptr, Size); }, ShirosMemoryManager::GetMaxSmallObjectSize() + 1, SIZE_MAX },
+		{ "CoroutineFrameAllocator", [](size_t Size) { return CoroutineFrameAllocator::Get().Allocate(Size); },
+			[](void* ptr, size_t Size) { CoroutineFrameAllocator::Get().Deallocate(ptr, Size); }, 0, SIZE_MAX },
+		{ "CacheLineAllocator", [](size_t Size) { return CacheLineAllocator::Get().Allocate(Size); },
+			[](void* ptr, size_t Size) { CacheLineAllocator::Get().Deallocate(ptr, Size); }, 0, CacheLineAllocator::MAX_BLOCK_SIZE }
+	};
+	const SizeDistribution Distributions[] = {
+		{ "16-128B", 16, 128 },
+		{ "256B-1KB", 256, 1024 },
+		{ "1-16KB", 1024, 16384 }
+	};
+	struct Benchmark
+	{
+		const char* name;
+		long long (*run)(const BenchmarkAllocator&, const SizeDistribution&, size_t);
+		/** Thread counts start here and double, so every column is comparable among benchmarks */
+		size_t minThreads;
+	};
+	const Benchmark Benchmarks[] = {
+		{ "threadtest", &RunThreadtest, 1 },
+		{ "larson", &RunLarson, 1 },
+		{ "xmalloc", &RunXmalloc, 2 } //a producer needs its consumer
+	};
+	const size_t MaxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+
+	for (const auto& Bench : Benchmarks)
+	{
+		for (const SizeDistribution& Sizes : Distributions)
+		{
+			for (const BenchmarkAllocator& Allocator : Allocators)
+			{
+				if (Sizes.minSize < Allocator.minSize || Sizes.maxSize > Allocator.maxSize) continue;
+
+				cout << Bench.name << " " << Sizes.name << " " << Allocator.name << ":";
+				for (size_t ThreadsCount = Bench.minThreads; ThreadsCount <= MaxThreads; ThreadsCount *= 2)
+				{
+					cout << " " << ThreadsCount << "T " << Bench.run(Allocator, Sizes, ThreadsCount) << " ops/ms";
+				}
+				cout << endl;
+			}
+		}
+	}
+
+	//counters are allocated by the main thread, the owner, so every allocator can serve them
+	for (const BenchmarkAllocator& Allocator : Allocators)
+	{
+		cout << "false sharing " << Allocator.name << ":";
+		for (size_t ThreadsCount = 1; ThreadsCount <= MaxThreads; ThreadsCount *= 2)
+		{
+			size_t CacheLines;
+			const long long OpsPerMs = RunFalseSharing(Allocator, ThreadsCount, CacheLines);
+			cout << " " << ThreadsCount << "T " << OpsPerMs << " ops/ms (" << CacheLines << " lines)";
+		}
+		cout << endl;
+	}
+
+	cout << "====== END OF MULTI THREADED BENCHMARK ======" << endl;
+}
+
+/** Per thread statistics bumped on every operation, the typical victim of false sharing */
+struct HotCounter : CacheLineIsolated<CacheLineAllocator::Isolation::LINE_PAIR>
+{
+	std::atomic<uint64_t> hits{ 0 };
+	std::atomic<uint64_t> misses{ 0 };
+};
+
+void CheckCacheLineIsolation()
+{
+	cout << "====== CACHE LINE ISOLATION TEST ======" << endl;
+
+	constexpr size_t ThreadsCount = 4;
+	constexpr size_t Increments = 1000000;
+	constexpr size_t CountersPerThread = 64;
+
+	//counters are created by their thread and released by the main one, through the remote lists
+	std::vector<HotCounter*> Counters(ThreadsCount * CountersPerThread);
+	RunThreads(ThreadsCount, [&Counters](size_t ThreadIndex) {
+		for (size_t i = 0; i < CountersPerThread; ++i)
+		{
+			HotCounter* Counter = new HotCounter();
+			assert(reinterpret_cast<size_t>(Counter) % 128 == 0);
+			Counters[ThreadIndex * CountersPerThread + i] = Counter;
+		}
+		for (size_t i = 0; i < Increments; ++i)
+		{
+			Counters[ThreadIndex * CountersPerThread + i % CountersPerThread]->hits.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	std::vector<size_t> Pairs(Counters.size());
+	for (size_t i = 0; i < Counters.size(); ++i)
+	{
+		Pairs[i] = reinterpret_cast<size_t>(Counters[i]) / 128;
+	}
+	std::sort(Pairs.begin(), Pairs.end());
+	assert(std::unique(Pairs.begin(), Pairs.end()) == Pairs.end() && "Two counters share a pair of cache lines");
+	cout << Counters.size() << " counters on " << Counters.size() << " distinct pairs of lines" << endl;
+
+	std::vector<void*> Released(Counters.begin(), Counters.end());
+	std::sort(Released.begin(), Released.end());
+
+	uint64_t Hits = 0;
+	for (HotCounter* Counter : Counters)
+	{
+		Hits += Counter->hits.load();
+		delete Counter;
+	}
+	assert(Hits == ThreadsCount * Increments);
+
+	//a new thread adopts the chunks left by an exited one: before mapping anything, it gets back the counters released remotely.
+	//untouched blocks of the chunks are carved first, so allocations go on until a whole thread worth of counters is back
+	const size_t MappedBefore = CacheLineAllocator::Get().GetTotalAllocatedMemory();
+	RunThreads(1, [&Released, MappedBefore](size_t) {
+		constexpr CacheLineAllocator::Isolation Isolation = CacheLineAllocator::Isolation::LINE_PAIR;
+		constexpr size_t MaxBlocks = 4096;
+		std::vector<void*> Blocks;
+		Blocks.reserve(MaxBlocks); //sized up front, the loop allocates nothing but counters
+		size_t Reused = 0;
+		while (Reused < CountersPerThread && Blocks.size() < MaxBlocks && CacheLineAllocator::Get().GetTotalAllocatedMemory() == MappedBefore)
+		{
+			Blocks.push_back(CacheLineAllocator::Get().Allocate(sizeof(HotCounter), Isolation));
+			Reused += std::binary_search(Released.begin(), Released.end(), Blocks.back()) ? 1 : 0;
+		}
+		assert(Reused == CountersPerThread && "Adopted chunks did not give back the counters released remotely");
+		for (void* Block : Blocks) CacheLineAllocator::Get().Deallocate(Block, sizeof(HotCounter));
+	});
+	assert(CacheLineAllocator::Get().GetTotalAllocatedMemory() == MappedBefore);
+
+	cout << "Mapped " << CacheLineAllocator::Get().GetTotalAllocatedMemory() << " bytes" << endl;
+	cout << "====== END OF CACHE LINE ISOLATION TEST ======" << endl;
+}
+
+/**
+ * Reads the first block of every chunk, over and over. Prints the L1 sets those blocks map to and the time per read.
+ * Chunks are carved from slabs, so they are all ChunkSize apart and their first blocks compete for the same sets unless coloured
+ */
+void RunChunkTraversal(bool Colouring)
+{
+	constexpr size_t ChunkSize = 16384;
+	constexpr size_t BlockSize = 16;
+	constexpr size_t BlocksPerChunk = UCHAR_MAX; //ChunkSize / BlockSize is over the cap, every chunk leaves a slack
+	constexpr size_t ChunksCount = 512;
+	constexpr size_t Passes = 20000;
+	constexpr size_t L1Sets = 64; //32KB, 8 ways, 64 bytes lines
+
+	ChunkSlabProvider Slabs(ChunkSize, false);
+	FixedAllocator Allocator(ChunkSize, BlockSize, FixedAllocator::FreeTracking::FREE_LIST, ChunkRetentionPolicy(), &Slabs, Colouring);
+	std::vector<void*> Blocks(ChunksCount * BlocksPerChunk);
+	for (void*& Block : Blocks)
+	{
+		Block = Allocator.Allocate();
+	}
+
+	//a new chunk hands out its blocks in order, so every BlocksPerChunk-th block opens a chunk
+	std::vector<volatile size_t*> Heads;
+	std::vector<bool> SetsUsed(L1Sets, false);
+	for (size_t i = 0; i < Blocks.size(); i += BlocksPerChunk)
+	{
+		Heads.push_back(static_cast<volatile size_t*>(Blocks[i]));
+		*Heads.back() = i;
+		SetsUsed[(reinterpret_cast<size_t>(Blocks[i]) / 64) % L1Sets] = true;
+	}
+
+	size_t Sum = 0;
+	auto start = system_clock::now();
+	for (size_t Pass = 0; Pass < Passes; ++Pass)
+	{
+		for (volatile size_t* Head : Heads)
+		{
+			Sum += *Head;
+		}
+	}
+	auto end = system_clock::now();
+	const long long Ns = duration_cast<nanoseconds>(end - start).count();
+	assert(Sum == Passes * (ChunksCount * (ChunksCount - 1) / 2) * BlocksPerChunk);
+
+	cout << (Colouring ? "Coloured chunks (" : "Plain chunks (") << Allocator.GetColoursCount() << " colours): ";
+	cout << std::count(SetsUsed.begin(), SetsUsed.end(), true) << " L1 sets touched, ";
+	cout << static_cast<double>(Ns) / (Passes * Heads.size()) << " ns/read" << endl;
+
+	for (void* Block : Blocks)
+	{
+		Allocator.Deallocate(Block);
+	}
+	Allocator.Release();
+}
+
+void ChunkColouringBenchmark()
+{
+	cout << "====== CHUNK COLOURING BENCHMARK ======" << endl;
+	RunChunkTraversal(false);
+	RunChunkTraversal(true);
+	cout << "====== END OF CHUNK COLOURING BENCHMARK ======" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	g_clientPath = argv[0];
+#ifdef METADATA_OVERHEAD_BENCHMARK
+	if (argc == 5 && std::strcmp(argv[1], "--metadata-workload") == 0)
+	{
+		RunMetadataWorkload(std::strtoul(argv[2], nullptr, 10), std::strtoul(argv[3], nullptr, 10), std::strcmp(argv[4], "glibc") == 0);
+		return 0;
+	}
+#endif
 #ifdef MM_TESTS
 	/* To properly check this test results disable macro GLOBAL_OP_OVERLOAD
 	 * Execute test in Release configuration in order to have a good comparison between default allocator and custom one
@@ -305,6 +1769,87 @@ int main()
 	a.push_back(SmallObjTest());
 	ShirosMemoryManager::Get().PrintMemoryState();
 	a.clear();
+
+	{
+		//node based containers: every node is a Single allocation served by SmallObjAllocator
+		std::list<SmallObjTest, ShirosSTLAllocator<SmallObjTest>> List;
+		std::map<int, SmallObjTest, std::less<int>, ShirosSTLAllocator<std::pair<const int, SmallObjTest>>> Map;
+		for (int i = 0; i < 100; ++i)
+		{
+			List.push_back(SmallObjTest());
+			Map[i] = SmallObjTest();
+		}
+		ShirosMemoryManager::Get().PrintMemoryState();
+	}
+	ShirosMemoryManager::Get().PrintMemoryState();
+#endif
+#ifdef REMOTE_FREE_TEST
+	CheckRemoteFree();
+#endif
+#ifdef BATCH_TEST
+	CheckBatchAllocation();
+#endif
+#ifdef PMR_TEST
+	CheckMemoryResources();
+#endif
+#ifdef OBJECT_POOL_TEST
+	CheckObjectPool();
+#endif
+#ifdef CHUNK_RETENTION_TEST
+	CheckChunkRetention();
+#endif
+#ifdef HUGE_PAGES_BENCHMARK
+	HugePagesBenchmark();
+#endif
+#ifdef LARGE_OBJ_ARENAS_BENCHMARK
+	LargeObjArenasBenchmark();
+#endif
+#ifdef LOCK_FREE_FIXED_ALLOCATOR_TEST
+	CheckLockFreeFixedAllocator();
+#endif
+
+#ifdef EPOCH_RECLAIM_TEST
+	CheckEpochReclaim();
+#endif
+
+#ifdef USABLE_SIZE_TEST
+	CheckUsableSize();
+#endif
+
+#ifdef LARGE_ALIGNMENT_TEST
+	CheckLargeAlignment();
+#endif
+
+#if defined(COROUTINE_FRAME_TEST) && defined(__cpp_impl_coroutine)
+	CoroutineFrameTest();
+#endif
+
+#ifdef SHARED_MEMORY_HEAP_TEST
+	CheckSharedMemoryHeap();
+#endif
+
+#ifdef PERSISTENT_HEAP_TEST
+	CheckPersistentHeap();
+#endif
+
+#ifdef LATENCY_BENCHMARK
+	LatencyBenchmark();
+#endif
+
+#ifdef METADATA_OVERHEAD_BENCHMARK
+	MetadataOverheadBenchmark();
+#endif
+
+#ifdef MULTI_THREADED_BENCHMARK
+	MultiThreadedBenchmark();
+#endif
+
+#ifdef CACHE_LINE_ISOLATION_TEST
+	CheckCacheLineIsolation();
+#endif
+
+#ifdef CHUNK_COLOURING_BENCHMARK
+	ChunkColouringBenchmark();
 #endif
 
 	return 0;
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/** Index of the least significant bit set. Value MUST be different from 0 */
+inline unsigned CountTrailingZeros(uint64_t value)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+	//32 bit targets do not provide the 64 bit scan
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(value)))
+	{
+		return static_cast<unsigned>(index);
+	}
+	_BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+	return static_cast<unsigned>(index) + 32;
+#else
+	return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+
+/** Index of the most significant bit set. Value MUST be different from 0 */
+inline unsigned FloorLog2(uint64_t value)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+	{
+		return static_cast<unsigned>(index) + 32;
+	}
+	_BitScanReverse(&index, static_cast<unsigned long>(value));
+	return static_cast<unsigned>(index);
+#else
+	return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
+
+/** Number of bits set */
+inline unsigned PopCount(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return static_cast<unsigned>(__builtin_popcountll(value));
+#else
+	//__popcnt64 requires POPCNT support at runtime, stay portable
+	value = value - ((value >> 1) & 0x5555555555555555ULL);
+	value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+	value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return static_cast<unsigned>((value * 0x0101010101010101ULL) >> 56);
+#endif
+}
@@ -0,0 +1,254 @@
+#include "pch.h"
+#include "CacheLineAllocator.h"
+#include "ShirosMemoryManager.h"
+#include "PageAllocator.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+	/** Chunks are carved from mappings of this size */
+	constexpr size_t SLAB_SIZE = 1048576; // 1 MB
+
+	inline size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	/** Free blocks host the link to the next one */
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+}
+
+/** Placed at the start of every chunk. Owner fields and the remote list sit on different lines, only the latter is written by other threads */
+struct CacheLineAllocator::Chunk
+{
+	/** Blocks start after a whole pair of lines, so they are aligned to any isolation unit */
+	static constexpr size_t HEADER_SIZE = static_cast<size_t>(Isolation::LINE_PAIR);
+
+	inline void* Allocate()
+	{
+		if (!localFree)
+		{
+			//blocks never handed out are carved lazily, a new chunk touches only the lines it serves
+			if (unused + blockSize <= end)
+			{
+				void* block = unused;
+				unused += blockSize;
+				return block;
+			}
+
+			//blocks released by other threads come back all at once
+			localFree = remoteFree.exchange(nullptr, std::memory_order_acquire);
+			if (!localFree) return nullptr;
+		}
+
+		FreeBlock* block = localFree;
+		localFree = block->next;
+		return block;
+	}
+
+	/** Never changes, heaps of exited threads are adopted as they are */
+	ThreadHeap* owner;
+	size_t blockSize;
+	FreeBlock* localFree;
+	unsigned char* unused;
+	unsigned char* end;
+	/** Next chunk of the same size class in the owner heap */
+	Chunk* next;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<FreeBlock*> remoteFree;
+};
+
+/** Chunks of a thread, one list per size class. The list head is the chunk that served the last allocation */
+struct CacheLineAllocator::ThreadHeap
+{
+	Chunk* chunks[CLASSES_COUNT] = {};
+	ThreadHeap* nextHeap = nullptr;
+	ThreadHeap* nextAbandoned = nullptr;
+};
+
+struct CacheLineAllocator::SlabRecord
+{
+	PageAllocator::Mapping mapping;
+	SlabRecord* next;
+};
+
+/** Heap of the calling thread, abandoned when the thread exits */
+struct CacheLineThreadHandle
+{
+	CacheLineAllocator::ThreadHeap* heap = nullptr;
+
+	~CacheLineThreadHandle()
+	{
+		if (heap)
+		{
+			CacheLineAllocator::Get().AbandonHeap(heap);
+		}
+	}
+};
+
+namespace {
+	thread_local CacheLineThreadHandle threadHandle;
+}
+
+CacheLineAllocator& CacheLineAllocator::Get()
+{
+	static CacheLineAllocator allocator;
+	return allocator;
+}
+
+CacheLineAllocator::~CacheLineAllocator()
+{
+	while (mp_slabs)
+	{
+		SlabRecord* slab = mp_slabs;
+		mp_slabs = slab->next;
+		PageAllocator::Unmap(slab->mapping);
+		std::free(slab);
+	}
+	while (mp_heaps)
+	{
+		ThreadHeap* heap = mp_heaps;
+		mp_heaps = heap->nextHeap;
+		heap->~ThreadHeap();
+		std::free(heap);
+	}
+}
+
+void* CacheLineAllocator::Allocate(size_t size, Isolation isolation /* = Isolation::CACHE_LINE */)
+{
+	assert(size > 0);
+	const size_t unit = static_cast<size_t>(isolation);
+	const size_t blockSize = AlignUp(size, unit);
+	if (blockSize > MAX_BLOCK_SIZE)
+	{
+		//whole units keep the header of the following block off the last line
+		void* p_res = ShirosMemoryManager::Get().Allocate(blockSize, ShirosMemoryManager::AllocationType::Single, unit);
+		if (!p_res) { throw std::bad_alloc(); }
+		return p_res;
+	}
+
+	ThreadHeap* heap = threadHandle.heap;
+	if (!heap)
+	{
+		heap = threadHandle.heap = AcquireHeap();
+	}
+
+	//hot objects are few, a linear walk over the chunks of the class is enough
+	Chunk*& head = heap->chunks[GetClassIndex(blockSize)];
+	for (Chunk* chunk = head, *prev = nullptr; chunk != nullptr; prev = chunk, chunk = chunk->next)
+	{
+		void* block = chunk->Allocate();
+		if (block)
+		{
+			if (prev)
+			{
+				//keep the chunk with free blocks first
+				prev->next = chunk->next;
+				chunk->next = head;
+				head = chunk;
+			}
+			return block;
+		}
+	}
+
+	Chunk* chunk = AcquireChunk(heap, blockSize);
+	chunk->next = head;
+	head = chunk;
+	return chunk->Allocate();
+}
+
+void CacheLineAllocator::Deallocate(void* ptr, size_t size) noexcept
+{
+	if (!ptr) return;
+	//MAX_BLOCK_SIZE is a multiple of both units, the rounding decides the tier alike
+	if (AlignUp(size, CACHE_LINE_SIZE) > MAX_BLOCK_SIZE)
+	{
+		ShirosMemoryManager::Get().Deallocate(ptr, AlignUp(size, CACHE_LINE_SIZE));
+		return;
+	}
+
+	Chunk* chunk = reinterpret_cast<Chunk*>(reinterpret_cast<size_t>(ptr) & ~(CHUNK_SIZE - 1));
+	FreeBlock* block = static_cast<FreeBlock*>(ptr);
+	if (chunk->owner == threadHandle.heap)
+	{
+		block->next = chunk->localFree;
+		chunk->localFree = block;
+		return;
+	}
+
+	FreeBlock* head = chunk->remoteFree.load(std::memory_order_relaxed);
+	do
+	{
+		block->next = head;
+	} while (!chunk->remoteFree.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+CacheLineAllocator::ThreadHeap* CacheLineAllocator::AcquireHeap()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (mp_abandonedHeaps)
+	{
+		//the chunks keep pointing to the heap, adopting it makes this thread their owner
+		ThreadHeap* heap = mp_abandonedHeaps;
+		mp_abandonedHeaps = heap->nextAbandoned;
+		heap->nextAbandoned = nullptr;
+		return heap;
+	}
+
+	//memory manager overrides global new, heaps are placed in raw memory
+	void* storage = std::malloc(sizeof(ThreadHeap));
+	if (!storage) { throw std::bad_alloc(); }
+	ThreadHeap* heap = new(storage) ThreadHeap();
+	heap->nextHeap = mp_heaps;
+	mp_heaps = heap;
+	return heap;
+}
+
+void CacheLineAllocator::AbandonHeap(ThreadHeap* heap)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	heap->nextAbandoned = mp_abandonedHeaps;
+	mp_abandonedHeaps = heap;
+}
+
+CacheLineAllocator::Chunk* CacheLineAllocator::AcquireChunk(ThreadHeap* owner, size_t blockSize)
+{
+	unsigned char* memory;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (mp_slabCursor == nullptr || mp_slabCursor + CHUNK_SIZE > mp_slabEnd)
+		{
+			//mappings are page aligned only, one chunk more leaves room to align the first one
+			void* record = std::malloc(sizeof(SlabRecord));
+			if (!record) { throw std::bad_alloc(); }
+			const PageAllocator::Mapping mapping = PageAllocator::Map(SLAB_SIZE + CHUNK_SIZE, false);
+			if (!mapping.ptr)
+			{
+				std::free(record);
+				throw std::bad_alloc();
+			}
+
+			SlabRecord* slab = new(record) SlabRecord{ mapping, mp_slabs };
+			mp_slabs = slab;
+			mp_slabCursor = reinterpret_cast<unsigned char*>(AlignUp(reinterpret_cast<size_t>(mapping.ptr), CHUNK_SIZE));
+			mp_slabEnd = static_cast<unsigned char*>(mapping.ptr) + mapping.size;
+			m_mappedBytes.fetch_add(mapping.size, std::memory_order_relaxed);
+		}
+		memory = mp_slabCursor;
+		mp_slabCursor += CHUNK_SIZE;
+	}
+
+	static_assert(sizeof(Chunk) <= Chunk::HEADER_SIZE, "Chunk header must fit the space before the first block");
+	Chunk* chunk = reinterpret_cast<Chunk*>(memory);
+	chunk->owner = owner;
+	chunk->blockSize = blockSize;
+	chunk->localFree = nullptr;
+	chunk->unused = memory + Chunk::HEADER_SIZE;
+	chunk->end = memory + CHUNK_SIZE;
+	chunk->next = nullptr;
+	new(&chunk->remoteFree) std::atomic<FreeBlock*>(nullptr);
+	return chunk;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+
+using std::size_t;
+
+/**
+ * Allocator for small objects written by several threads, such as per-thread counters or locks.
+ * Every block is padded and aligned to a whole isolation unit, a cache line or a pair of lines,
+ * so two blocks can never share a line and writes to one never invalidate another.
+ * Chunks are owned by a thread: the owner allocates and frees without atomics, blocks released by other threads
+ * are pushed on a lock-free list of their chunk and taken back by the owner when the chunk runs dry.
+ * When a thread exits its chunks are handed to the next thread asking for some.
+ * Only objects allocated here pay the padding, every other request keeps the packed size classes of the Memory Manager
+ */
+class CacheLineAllocator /*Singleton*/
+{
+public:
+	/** Room a block gets for itself */
+	enum class Isolation
+	{
+		/** Blocks are made of whole cache lines */
+		CACHE_LINE = 64,
+		/** Blocks are made of whole pairs of lines, so the adjacent line prefetcher does not couple two blocks either */
+		LINE_PAIR = 128
+	};
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+	static constexpr size_t MAX_BLOCK_SIZE = 1024;
+	/** Chunks are aligned to their size, a block finds the header of its chunk by masking its address */
+	static constexpr size_t CHUNK_SIZE = 16384;
+
+	static CacheLineAllocator& Get();
+	~CacheLineAllocator();
+
+	/** Prevent copy for this class */
+	CacheLineAllocator(const CacheLineAllocator&) = delete;
+	CacheLineAllocator& operator=(const CacheLineAllocator&) = delete;
+
+	/**
+	 * Thread-safe. Served by a chunk of the calling thread.
+	 * Blocks larger than MAX_BLOCK_SIZE go to the Memory Manager, rounded and aligned to the isolation unit.
+	 * Throws std::bad_alloc on failure
+	 */
+	void* Allocate(size_t size, Isolation isolation = Isolation::CACHE_LINE);
+	/** Thread-safe. size is the one requested at allocation */
+	void Deallocate(void* ptr, size_t size) noexcept;
+
+	/** Memory mapped for the chunks */
+	inline size_t GetTotalAllocatedMemory() const { return m_mappedBytes.load(std::memory_order_relaxed); }
+
+private:
+	static constexpr size_t CLASSES_COUNT = MAX_BLOCK_SIZE / CACHE_LINE_SIZE;
+
+	static inline size_t GetClassIndex(size_t blockSize) { return blockSize / CACHE_LINE_SIZE - 1; }
+
+	struct Chunk;
+	struct ThreadHeap;
+	struct SlabRecord;
+
+	CacheLineAllocator() = default;
+
+	/** Heap left by an exited thread if any, a new one otherwise */
+	ThreadHeap* AcquireHeap();
+	void AbandonHeap(ThreadHeap* heap);
+	Chunk* AcquireChunk(ThreadHeap* owner, size_t blockSize);
+
+	/** Guards the slabs and the heaps lists, taken only when a chunk or a heap is created */
+	std::mutex m_lock;
+	SlabRecord* mp_slabs = nullptr;
+	unsigned char* mp_slabCursor = nullptr;
+	unsigned char* mp_slabEnd = nullptr;
+	/** Every heap ever created, and the ones whose thread exited */
+	ThreadHeap* mp_heaps = nullptr;
+	ThreadHeap* mp_abandonedHeaps = nullptr;
+	std::atomic<size_t> m_mappedBytes{ 0 };
+
+	friend struct CacheLineThreadHandle;
+};
+
+/** Inherit from it in a type written by several threads: its instances never share a line, or a pair of lines, with other blocks */
+template <CacheLineAllocator::Isolation isolation = CacheLineAllocator::Isolation::CACHE_LINE>
+struct CacheLineIsolated
+{
+	static void* operator new(std::size_t size) { return CacheLineAllocator::Get().Allocate(size, isolation); }
+	static void operator delete(void* ptr, std::size_t size) noexcept { CacheLineAllocator::Get().Deallocate(ptr, size); }
+};
@@ -0,0 +1,143 @@
+#include "pch.h"
+#include "CoroutineFrameAllocator.h"
+#include "ShirosMemoryManager.h"
+#include <cstdlib>
+#include <new>
+
+/** Per thread free lists of frames, given back to the shared allocators when the thread exits */
+struct FrameThreadCache
+{
+	/** Cached frames are unused, their first bytes host the link */
+	struct FreeFrame
+	{
+		FreeFrame* next;
+	};
+
+	FreeFrame* heads[CoroutineFrameAllocator::CLASSES_COUNT] = {};
+	size_t counts[CoroutineFrameAllocator::CLASSES_COUNT] = {};
+
+	~FrameThreadCache()
+	{
+		for (size_t i = 0; i < CoroutineFrameAllocator::CLASSES_COUNT; ++i)
+		{
+			if (!heads[i]) continue;
+
+			LockFreeFixedAllocator& allocator = CoroutineFrameAllocator::Get().GetClassAllocator(i);
+			while (heads[i])
+			{
+				FreeFrame* frame = heads[i];
+				heads[i] = frame->next;
+				allocator.Deallocate(frame);
+			}
+			counts[i] = 0;
+		}
+	}
+};
+
+namespace {
+	thread_local FrameThreadCache frameCache;
+}
+
+CoroutineFrameAllocator& CoroutineFrameAllocator::Get()
+{
+	static CoroutineFrameAllocator allocator;
+	return allocator;
+}
+
+CoroutineFrameAllocator::CoroutineFrameAllocator()
+{
+	for (size_t i = 0; i < CLASSES_COUNT; ++i)
+	{
+		m_classes[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+CoroutineFrameAllocator::~CoroutineFrameAllocator()
+{
+	for (size_t i = 0; i < CLASSES_COUNT; ++i)
+	{
+		LockFreeFixedAllocator* allocator = m_classes[i].load(std::memory_order_relaxed);
+		if (allocator)
+		{
+			allocator->~LockFreeFixedAllocator();
+			std::free(allocator);
+		}
+	}
+}
+
+LockFreeFixedAllocator& CoroutineFrameAllocator::GetClassAllocator(size_t index)
+{
+	LockFreeFixedAllocator* allocator = m_classes[index].load(std::memory_order_acquire);
+	if (allocator) return *allocator;
+
+	//memory manager overrides global new, the allocator is placed in raw memory
+	void* storage = std::malloc(sizeof(LockFreeFixedAllocator));
+	if (!storage) { throw std::bad_alloc(); }
+	LockFreeFixedAllocator* created = new(storage) LockFreeFixedAllocator(GetClassSize(index));
+
+	//another thread may have created it meanwhile, keep the published one
+	if (!m_classes[index].compare_exchange_strong(allocator, created, std::memory_order_acq_rel, std::memory_order_acquire))
+	{
+		created->~LockFreeFixedAllocator();
+		std::free(created);
+		return *allocator;
+	}
+	return *created;
+}
+
+void* CoroutineFrameAllocator::Allocate(size_t size)
+{
+	assert(size > 0);
+	if (size > MAX_FRAME_SIZE)
+	{
+		void* p_res = ShirosMemoryManager::Get().Allocate(size, ShirosMemoryManager::AllocationType::Single);
+		if (!p_res) { throw std::bad_alloc(); }
+		return p_res;
+	}
+
+	const size_t index = GetClassIndex(size);
+	FrameThreadCache::FreeFrame* frame = frameCache.heads[index];
+	if (frame)
+	{
+		frameCache.heads[index] = frame->next;
+		--frameCache.counts[index];
+		return frame;
+	}
+	return GetClassAllocator(index).Allocate();
+}
+
+void CoroutineFrameAllocator::Deallocate(void* ptr, size_t size) noexcept
+{
+	if (!ptr) return;
+	if (size > MAX_FRAME_SIZE)
+	{
+		ShirosMemoryManager::Get().Deallocate(ptr, size);
+		return;
+	}
+
+	const size_t index = GetClassIndex(size);
+	if (frameCache.counts[index] < THREAD_CACHE_DEPTH)
+	{
+		FrameThreadCache::FreeFrame* frame = static_cast<FrameThreadCache::FreeFrame*>(ptr);
+		frame->next = frameCache.heads[index];
+		frameCache.heads[index] = frame;
+		++frameCache.counts[index];
+		return;
+	}
+	//the class allocator exists, the frame was served by it
+	m_classes[index].load(std::memory_order_acquire)->Deallocate(ptr);
+}
+
+size_t CoroutineFrameAllocator::GetTotalAllocatedMemory() const
+{
+	size_t totMemoryAllocated = 0;
+	for (size_t i = 0; i < CLASSES_COUNT; ++i)
+	{
+		const LockFreeFixedAllocator* allocator = m_classes[i].load(std::memory_order_acquire);
+		if (allocator)
+		{
+			totMemoryAllocated += allocator->GetTotalAllocatedMemory();
+		}
+	}
+	return totMemoryAllocated;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include "LockFreeFixedAllocator.h"
+
+/**
+ * Allocator for C++20 coroutine frames. All the frames of a coroutine have the same size,
+ * so they are served by size classes of FRAME_GRANULARITY bytes, each one backed by a LockFreeFixedAllocator.
+ * Every thread keeps a short free list per size class: creating a frame pops from it and destroying one pushes back,
+ * only misses and overflows reach the shared allocators. Frames larger than MAX_FRAME_SIZE go to the Memory Manager.
+ * Frames can be destroyed by a thread other than the one that created them.
+ * Promise types opt in by inheriting from CoroutineFrameAllocation, no C++20 feature is needed by this header
+ */
+class CoroutineFrameAllocator /*Singleton*/
+{
+public:
+	/** Frames get the alignment of global operator new */
+	static constexpr size_t FRAME_GRANULARITY = alignof(std::max_align_t);
+	static constexpr size_t MAX_FRAME_SIZE = 1024;
+	/** Frames each thread keeps per size class before giving them back to the shared allocator */
+	static constexpr size_t THREAD_CACHE_DEPTH = 64;
+
+	static CoroutineFrameAllocator& Get();
+	~CoroutineFrameAllocator();
+
+	/** Prevent copy for this class */
+	CoroutineFrameAllocator(const CoroutineFrameAllocator&) = delete;
+	CoroutineFrameAllocator& operator=(const CoroutineFrameAllocator&) = delete;
+
+	/** Thread-safe. Throws std::bad_alloc on failure, as coroutine frame allocation expects */
+	void* Allocate(size_t size);
+	/** Thread-safe. size is the one requested at allocation, as passed by sized delete */
+	void Deallocate(void* ptr, size_t size) noexcept;
+
+	/** Memory reserved by the size classes slabs */
+	size_t GetTotalAllocatedMemory() const;
+
+private:
+	static constexpr size_t CLASSES_COUNT = MAX_FRAME_SIZE / FRAME_GRANULARITY;
+
+	static inline size_t GetClassIndex(size_t size) { return (size - 1) / FRAME_GRANULARITY; }
+	static inline size_t GetClassSize(size_t index) { return (index + 1) * FRAME_GRANULARITY; }
+
+	CoroutineFrameAllocator();
+
+	/** Shared allocator of a size class, created on first use */
+	LockFreeFixedAllocator& GetClassAllocator(size_t index);
+
+	std::atomic<LockFreeFixedAllocator*> m_classes[CLASSES_COUNT];
+
+	friend struct FrameThreadCache;
+};
+
+/** Inherit from it in a promise type: the compiler allocates the frames of its coroutines through these operators */
+struct CoroutineFrameAllocation
+{
+	static void* operator new(std::size_t size) { return CoroutineFrameAllocator::Get().Allocate(size); }
+	static void operator delete(void* ptr, std::size_t size) noexcept { CoroutineFrameAllocator::Get().Deallocate(ptr, size); }
+};
@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "EpochReclaimer.h"
+#include "ShirosMemoryManager.h"
+#include <cstdlib>
+
+/** Binds a thread to its record, the record is released when the thread exits */
+struct EpochThreadHandle
+{
+	EpochReclaimer::ThreadRecord* record = nullptr;
+
+	~EpochThreadHandle()
+	{
+		if (!record) return;
+		assert(record->guardDepth == 0 && "Thread exited inside an epoch critical section");
+		//pending blocks stay in the record, the next thread acquiring it will reclaim them
+		record->epoch.store(EpochReclaimer::QUIESCENT, std::memory_order_release);
+		record->inUse.store(false, std::memory_order_release);
+	}
+};
+
+EpochReclaimer& EpochReclaimer::Get()
+{
+	static EpochReclaimer reclaimer;
+	return reclaimer;
+}
+
+EpochReclaimer::EpochReclaimer()
+	: m_globalEpoch(1) //0 is QUIESCENT
+{
+	//retired blocks go back to the Memory Manager up to the destructor: construct it first, so it is destroyed last
+	ShirosMemoryManager::Get();
+
+	for (size_t i = 0; i < MAX_THREADS; ++i)
+	{
+		m_records[i].epoch.store(QUIESCENT, std::memory_order_relaxed);
+		m_records[i].inUse.store(false, std::memory_order_relaxed);
+	}
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+	//threads are gone, nobody can read retired blocks anymore
+	for (size_t i = 0; i < MAX_THREADS; ++i)
+	{
+		for (Bag& bag : m_records[i].bags)
+		{
+			ReclaimBag(bag);
+		}
+	}
+}
+
+EpochReclaimer::ThreadRecord& EpochReclaimer::GetThreadRecord()
+{
+	thread_local EpochThreadHandle handle;
+	if (handle.record) return *handle.record;
+
+	for (size_t i = 0; i < MAX_THREADS; ++i)
+	{
+		bool expected = false;
+		if (!m_records[i].inUse.load(std::memory_order_relaxed)
+			&& m_records[i].inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+		{
+			handle.record = &m_records[i];
+			return *handle.record;
+		}
+	}
+
+	assert(false && "Too many threads registered to EpochReclaimer");
+	std::abort();
+}
+
+void EpochReclaimer::Enter()
+{
+	ThreadRecord& record = GetThreadRecord();
+	if (record.guardDepth++ > 0) return;
+
+	//publish the observed epoch before reading any shared node
+	record.epoch.store(m_globalEpoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+}
+
+void EpochReclaimer::Leave()
+{
+	ThreadRecord& record = GetThreadRecord();
+	assert(record.guardDepth > 0);
+	if (--record.guardDepth > 0) return;
+
+	record.epoch.store(QUIESCENT, std::memory_order_release);
+}
+
+void EpochReclaimer::Retire(void* ptr, size_t size)
+{
+	assert(ptr && size > 0);
+	ThreadRecord& record = GetThreadRecord();
+
+	const uint64_t epoch = m_globalEpoch.load(std::memory_order_acquire);
+	Bag& bag = record.bags[epoch % 3];
+	if (bag.epoch != epoch)
+	{
+		//bag belongs to an epoch at least three steps behind, every reader has left it
+		record.retiredCount -= ReclaimBag(bag);
+		bag.epoch = epoch;
+	}
+	bag.blocks.push_back(RetiredBlock{ ptr, size });
+
+	if (++record.retiredCount >= RECLAIM_THRESHOLD)
+	{
+		TryReclaim();
+	}
+}
+
+size_t EpochReclaimer::TryReclaim()
+{
+	ThreadRecord& record = GetThreadRecord();
+	TryAdvance();
+
+	//blocks retired in epoch e may be read only by threads that entered in e or e - 1
+	const uint64_t epoch = m_globalEpoch.load(std::memory_order_acquire);
+	size_t reclaimed = 0;
+	for (Bag& bag : record.bags)
+	{
+		if (!bag.blocks.empty() && bag.epoch + 2 <= epoch)
+		{
+			reclaimed += ReclaimBag(bag);
+		}
+	}
+	record.retiredCount -= reclaimed;
+	return reclaimed;
+}
+
+bool EpochReclaimer::TryAdvance()
+{
+	const uint64_t epoch = m_globalEpoch.load(std::memory_order_seq_cst);
+	for (size_t i = 0; i < MAX_THREADS; ++i)
+	{
+		const uint64_t observed = m_records[i].epoch.load(std::memory_order_seq_cst);
+		if (observed != QUIESCENT && observed != epoch) return false; //a reader is still in the previous epoch
+	}
+
+	uint64_t expected = epoch;
+	return m_globalEpoch.compare_exchange_strong(expected, epoch + 1, std::memory_order_acq_rel);
+}
+
+size_t EpochReclaimer::ReclaimBag(Bag& bag)
+{
+	RetiredBlocks& blocks = bag.blocks;
+	const size_t count = blocks.size();
+	if (count == 0) return 0;
+
+	//group blocks by size, each group is released with a single batch
+	std::sort(blocks.begin(), blocks.end(), [](const RetiredBlock& lhs, const RetiredBlock& rhs) { return lhs.size < rhs.size; });
+
+	void* batch[RECLAIM_THRESHOLD];
+	size_t batchCount = 0;
+	ShirosMemoryManager& mm = ShirosMemoryManager::Get();
+	for (size_t i = 0; i < count; ++i)
+	{
+		batch[batchCount++] = blocks[i].ptr;
+		const bool lastOfSize = i + 1 == count || blocks[i + 1].size != blocks[i].size;
+		if (lastOfSize || batchCount == RECLAIM_THRESHOLD)
+		{
+			mm.DeallocateBatch(batch, batchCount, blocks[i].size);
+			batchCount = 0;
+		}
+	}
+
+	blocks.clear();
+	return count;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include "Mallocator.h"
+
+/**
+ * Epoch based reclamation for lock-free data structures built on the Memory Manager.
+ * Readers enter a critical section with an EpochGuard, writers Retire the nodes they unlinked.
+ * A retired block is given back only when every thread has left the epoch in which it was retired,
+ * and it is given back in batches of blocks of the same size through ShirosMemoryManager::DeallocateBatch,
+ * so small blocks go straight back to their FixedAllocator with a single lookup per batch.
+ * Each thread owns a record among MAX_THREADS; records are recycled, with their pending blocks, when threads exit
+ */
+class EpochReclaimer /*Singleton*/
+{
+public:
+	static constexpr size_t MAX_THREADS = 128;
+	/** Blocks retired by a thread before it tries to advance the epoch and reclaim */
+	static constexpr size_t RECLAIM_THRESHOLD = 64;
+
+	static EpochReclaimer& Get();
+
+	/** Prevent copy for this class */
+	EpochReclaimer(const EpochReclaimer&) = delete;
+	EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+	/** Mark the calling thread as reading shared nodes. Guards can be nested */
+	void Enter();
+	void Leave();
+
+	/** Defer the deallocation of a block no longer reachable by new readers. Size is the one used to allocate it */
+	void Retire(void* ptr, size_t size);
+	/** Try to advance the epoch and give back the calling thread blocks that no reader can access anymore. Returns the number of reclaimed blocks */
+	size_t TryReclaim();
+
+	inline uint64_t GetEpoch() const { return m_globalEpoch.load(std::memory_order_relaxed); }
+
+private:
+	EpochReclaimer();
+	/** Gives back whatever is still pending, no reader is left at this point */
+	~EpochReclaimer();
+
+	struct RetiredBlock
+	{
+		void* ptr;
+		size_t size;
+	};
+	using RetiredBlocks = std::vector<RetiredBlock, Mallocator<RetiredBlock>>;
+
+	/** Blocks retired during the same epoch */
+	struct Bag
+	{
+		uint64_t epoch = 0;
+		RetiredBlocks blocks;
+	};
+
+	/** Per thread state, alone on its cache line since readers write their epoch on every guard */
+	struct alignas(64) ThreadRecord
+	{
+		/** Epoch observed when entering the critical section, QUIESCENT outside of it */
+		std::atomic<uint64_t> epoch;
+		std::atomic<bool> inUse;
+		/** Touched only by the thread owning the record */
+		size_t guardDepth = 0;
+		size_t retiredCount = 0;
+		Bag bags[3];
+	};
+
+	static constexpr uint64_t QUIESCENT = 0;
+
+	/** Record of the calling thread, acquired on first use and released when the thread exits */
+	ThreadRecord& GetThreadRecord();
+	/** Advance the global epoch if every active thread has observed the current one */
+	bool TryAdvance();
+	/** Give back the blocks of a bag, one DeallocateBatch per block size */
+	size_t ReclaimBag(Bag& bag);
+
+	std::atomic<uint64_t> m_globalEpoch;
+	ThreadRecord m_records[MAX_THREADS];
+
+	friend struct EpochThreadHandle;
+};
+
+/** Keeps the calling thread inside an epoch critical section for its lifetime */
+class EpochGuard
+{
+public:
+	EpochGuard() { EpochReclaimer::Get().Enter(); }
+	~EpochGuard() { EpochReclaimer::Get().Leave(); }
+
+	/** Prevent copy for this class */
+	EpochGuard(const EpochGuard&) = delete;
+	EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -1,28 +1,59 @@
 #include "pch.h"
 #include "FixedAllocator.h"
+#include "Tracepoints.h"
+#include <chrono>
 
-void FixedAllocator::Chunk::Init(size_t blockSize, unsigned char blocks)
+void FixedAllocator::Chunk::Init(unsigned char* data, size_t blockSize, unsigned char blocks, FreeTracking tracking)
 {
+	assert(data != nullptr);
 	assert(blockSize > 0); //block size MUST be greater than 0, min. 1
 	assert(blocks > 0); //chunk must be composed of at least one element (i.e an element of max size)
 	assert((blockSize * blocks) / blockSize == blocks); // check for overflow
 
-	m_data = static_cast<unsigned char*>(std::malloc(blockSize * blocks)); //reserve heap memory for the chunk. 
-	Reset(blockSize, blocks);
+	m_data = data;
+	Reset(blockSize, blocks, tracking);
 }
 
-void* FixedAllocator::Chunk::Allocate(size_t blockSize)
+size_t FixedAllocator::Chunk::AllocateBatch(size_t blockSize, void** OutBlocks, size_t Count)
 {
-	if (m_blocksAvailable == 0) return nullptr;
+	const size_t toAllocate = Count < m_blocksAvailable ? Count : m_blocksAvailable;
 
-	assert((m_firstAvailableBlock * blockSize) / blockSize == m_firstAvailableBlock); //overflow check
-	
-	unsigned char* result = m_data + (m_firstAvailableBlock * blockSize); //simple arithmetic operation to find new block start
-	m_firstAvailableBlock = *result; //copy index of next available block contained in result
-	
-	--m_blocksAvailable; //decrement available blocks in chunk
-	
-	return result;
+	//walk the free list run without touching the chunk counters at every step
+	unsigned char firstAvailableBlock = m_firstAvailableBlock;
+	for (size_t i = 0; i < toAllocate; ++i)
+	{
+		unsigned char* result = m_data + (firstAvailableBlock * blockSize);
+		firstAvailableBlock = *result;
+		OutBlocks[i] = result;
+	}
+
+	m_firstAvailableBlock = firstAvailableBlock;
+	m_blocksAvailable -= static_cast<unsigned char>(toAllocate);
+
+	return toAllocate;
+}
+
+size_t FixedAllocator::Chunk::AllocateBatchFromBitmap(size_t blockSize, void** OutBlocks, size_t Count)
+{
+	const size_t toAllocate = Count < m_blocksAvailable ? Count : m_blocksAvailable;
+
+	size_t allocated = 0;
+	for (unsigned char w = 0; allocated < toAllocate; ++w)
+	{
+		//consume the word in a register and write it back once
+		uint64_t word = m_freeBitmap[w];
+		while (word && allocated < toAllocate)
+		{
+			const unsigned bit = CountTrailingZeros(word);
+			word &= word - 1;
+			OutBlocks[allocated++] = m_data + ((w * 64 + bit) * blockSize);
+		}
+		m_freeBitmap[w] = word;
+	}
+
+	m_blocksAvailable -= static_cast<unsigned char>(allocated);
+
+	return allocated;
 }
 
 void FixedAllocator::Chunk::Deallocate(void* p, size_t blockSize)
@@ -43,7 +74,32 @@ void FixedAllocator::Chunk::Deallocate(void* p, size_t blockSize)
 	++m_blocksAvailable;
 }
 
-void FixedAllocator::Chunk::Reset(size_t blockSize, unsigned char blocks)
+void FixedAllocator::Chunk::DeallocateToBitmap(void* p, size_t blockSize)
+{
+	assert(p >= m_data); //ensure ptr is greater or equal to the first address contained in m_data
+
+	const size_t offset = static_cast<unsigned char*>(p) - m_data;
+	assert(offset % blockSize == 0); //alignment check to blockSize provided in input. 
+
+	const size_t index = offset / blockSize;
+	assert((m_freeBitmap[index / 64] & (1ULL << (index % 64))) == 0); //double free
+
+	m_freeBitmap[index / 64] |= 1ULL << (index % 64);
+
+	++m_blocksAvailable;
+}
+
+unsigned FixedAllocator::Chunk::CountFreeInBitmap(unsigned char blocks) const
+{
+	unsigned count = 0;
+	for (unsigned char w = 0; w < BitmapWords(blocks); ++w)
+	{
+		count += PopCount(m_freeBitmap[w]);
+	}
+	return count;
+}
+
+void FixedAllocator::Chunk::Reset(size_t blockSize, unsigned char blocks, FreeTracking tracking)
 {
 	assert(blockSize > 0); //block size MUST be greater than 0, min. 1
 	assert(blocks > 0); //chunk must be composed of at least one element (i.e an element of max size)
@@ -52,6 +108,17 @@ void FixedAllocator::Chunk::Reset(size_t blockSize, unsigned char blocks)
 	m_firstAvailableBlock = 0; // reset to first block available
 	m_blocksAvailable = blocks; //all blocks available
 
+	if (tracking == FreeTracking::BITMAP)
+	{
+		//blocks memory is left untouched, all valid bits are set
+		assert(m_freeBitmap != nullptr);
+		for (unsigned char w = 0; w < BitmapWords(blocks); ++w)
+		{
+			m_freeBitmap[w] = ValidBits(w, blocks);
+		}
+		return;
+	}
+
 	unsigned char* p_temp = m_data;
 	for (unsigned char i = 0; i != blocks; p_temp += blockSize)
 	{
@@ -60,16 +127,15 @@ void FixedAllocator::Chunk::Reset(size_t blockSize, unsigned char blocks)
 	}
 }
 
-void FixedAllocator::Chunk::Release()
-{
-	assert(m_data != nullptr);
-	std::free(m_data);
-}
-
-FixedAllocator::FixedAllocator(size_t ChunkSize /*= 0*/,size_t BlockSize /*= 0*/)
+FixedAllocator::FixedAllocator(size_t ChunkSize /*= 0*/,size_t BlockSize /*= 0*/, FreeTracking Tracking /*= FreeTracking::FREE_LIST*/, const ChunkRetentionPolicy& Retention /*= ChunkRetentionPolicy()*/,
+	ChunkSlabProvider* SlabProvider /*= nullptr*/, bool Colouring /*= false*/)
 	: m_blockSize(BlockSize),
+	m_freeTracking(Tracking),
+	m_retention(Retention),
+	mp_slabProvider(SlabProvider),
 	m_lastChunkUsedForAllocation(nullptr),
-	m_lastChunkUsedForDeallocation(nullptr)
+	m_lastChunkUsedForDeallocation(nullptr),
+	m_remoteFreeList(nullptr)
 {
 	assert(BlockSize > 0); //ensure you're not creating an allocator of size 0, min. 1
 	
@@ -89,29 +155,50 @@ FixedAllocator::FixedAllocator(size_t ChunkSize /*= 0*/,size_t BlockSize /*= 0*/
 		numBlocks = CHAR_BIT * BlockSize; //fallback
 	}
 
+	assert(m_retention.mode != ChunkRetentionPolicy::Mode::WATERMARK || m_retention.lowWatermark <= m_retention.highWatermark);
+
 	m_numBlocks = static_cast<unsigned char>(numBlocks);
 	assert(m_numBlocks == numBlocks); //validate assignment 
+
+	//slack is what the block limit leaves unused in a chunk, colouring only moves the blocks inside it
+	const size_t chunkBytes = numBlocks * BlockSize;
+	if (Colouring && AllocatorChunkSize > chunkBytes)
+	{
+		m_coloursCount = static_cast<uint16_t>(std::min((AllocatorChunkSize - chunkBytes) / COLOUR_STEP + 1, MAX_COLOURS));
+	}
 }
 
 FixedAllocator::FixedAllocator(const FixedAllocator& other)
 	: m_blockSize(other.m_blockSize),
 	m_numBlocks(other.m_numBlocks),
-	m_chunks(other.m_chunks)
+	m_freeTracking(other.m_freeTracking),
+	m_retention(other.m_retention),
+	m_chunksCreated(other.m_chunksCreated),
+	m_chunksDestroyed(other.m_chunksDestroyed),
+	mp_slabProvider(other.mp_slabProvider),
+	m_coloursCount(other.m_coloursCount),
+	m_nextColour(other.m_nextColour),
+	m_chunks(other.m_chunks),
+	m_remoteFreeList(nullptr)
 {
+	assert(other.m_remoteFreeList.load(std::memory_order_relaxed) == nullptr); //pending remote frees must be drained before copying
+
 	//insert constructed Allocator between other and the previous element following other
 	prev = &other;
 	next = other.next;
 	other.next->prev = this;
 	other.next = this;
 
-	//compute local address for last chunk used for allocation using the offset of other.m_lastChunkUsedForAllocation address from other starting address
+	//chunks keep their index in the copy, use it to find the local address of the cached chunks
 	m_lastChunkUsedForAllocation = other.m_lastChunkUsedForAllocation
-		? &m_chunks.front() + (other.m_lastChunkUsedForAllocation - &other.m_chunks.front())
+		? &m_chunks[other.m_lastChunkUsedForAllocation->m_index]
 		: 0;
-	//compute local address for last chunk used for deallocation using the offset of other.m_lastChunkUsedForDeallocation address from other starting address
 	m_lastChunkUsedForDeallocation = other.m_lastChunkUsedForDeallocation
-		? &m_chunks.front() + (other.m_lastChunkUsedForDeallocation - &other.m_chunks.front())
+		? &m_chunks[other.m_lastChunkUsedForDeallocation->m_index]
 		: 0;
+
+	//lists are made of chunk indices, they are valid for the copied chunks too
+	std::copy(other.m_chunkLists, other.m_chunkLists + LISTS_COUNT, m_chunkLists);
 }
 
 FixedAllocator& FixedAllocator::operator=(const FixedAllocator& other)
@@ -144,9 +231,9 @@ FixedAllocator::~FixedAllocator()
 	assert(prev == next); //detached fixed allocator
 	
 	//release all chunks for this FixedAllocator
-	for (Chunks::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+	for (size_t i = 0; i < m_chunks.size(); ++i)
 	{
-		it->Release();
+		ReleaseChunkMemory(m_chunks[i]);
 	}
 }
 
@@ -155,52 +242,205 @@ void FixedAllocator::Swap(FixedAllocator& other)
 	using std::swap;
 	swap(m_blockSize, other.m_blockSize);
 	swap(m_numBlocks, other.m_numBlocks);
+	swap(m_freeTracking, other.m_freeTracking);
+	swap(m_retention, other.m_retention);
+	swap(m_chunksCreated, other.m_chunksCreated);
+	swap(m_chunksDestroyed, other.m_chunksDestroyed);
+	swap(mp_slabProvider, other.mp_slabProvider);
+	swap(m_coloursCount, other.m_coloursCount);
+	swap(m_nextColour, other.m_nextColour);
 	m_chunks.swap(other.m_chunks);
+	std::swap_ranges(m_chunkLists, m_chunkLists + LISTS_COUNT, other.m_chunkLists);
 	swap(m_lastChunkUsedForAllocation, other.m_lastChunkUsedForAllocation);
 	swap(m_lastChunkUsedForDeallocation, other.m_lastChunkUsedForDeallocation);
+	//swap is performed by the owner, no foreign thread is expected to push meanwhile
+	void* remoteFreeList = m_remoteFreeList.load(std::memory_order_relaxed);
+	m_remoteFreeList.store(other.m_remoteFreeList.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	other.m_remoteFreeList.store(remoteFreeList, std::memory_order_relaxed);
 }
 
-void* FixedAllocator::Allocate()
+void FixedAllocator::FindChunkForAllocation()
 {
-	if (m_lastChunkUsedForAllocation == 0 || m_lastChunkUsedForAllocation->m_blocksAvailable == 0)
+	//slow path: take back blocks released by other threads before looking for a free chunk
+	DrainRemoteFrees();
+
+	if (m_lastChunkUsedForAllocation)
+	{
+		if (m_lastChunkUsedForAllocation->m_blocksAvailable > 0) return; //remote frees refilled it
+
+		//the chunk we were allocating from is full, file it before picking another one
+		LinkChunk(GetChunkIndex(m_lastChunkUsedForAllocation), FULL_LIST);
+		m_lastChunkUsedForAllocation = nullptr;
+	}
+
+	//prefer the fullest partial chunks to let the emptier ones drain, then empty chunks
+	for (unsigned char list = 0; list <= EMPTY_LIST; ++list)
 	{
-		for (Chunks::iterator it = m_chunks.begin();; ++it)
+		if (list == FULL_LIST) continue;
+
+		const uint32_t index = m_chunkLists[list].head;
+		if (index != NO_CHUNK)
 		{
-			if (it == m_chunks.end())
-			{
-				//append new chunk
-				//reserve memory for all the already present chunks and also for the new one
-				m_chunks.reserve(m_chunks.size() + 1);
-				
-				Chunk NewChunk;
-				NewChunk.Init(m_blockSize, m_numBlocks);
-				
-				m_chunks.push_back(NewChunk);
-				m_lastChunkUsedForAllocation  = &m_chunks.back();
-				m_lastChunkUsedForDeallocation = &m_chunks.front();
-				
-				break;
-			}
+			UnlinkChunk(index);
+			m_lastChunkUsedForAllocation = &m_chunks[index];
+			return;
+		}
+	}
 
-			if (it->m_blocksAvailable > 0)
-			{
-				m_lastChunkUsedForAllocation = &*it;
-				break;
-			}
+	//append new chunk. Existing chunks are not moved, cached pointers stay valid
+	assert(m_chunks.size() < NO_CHUNK);
+	
+	const size_t colourOffset = m_nextColour * COLOUR_STEP;
+	m_nextColour = static_cast<uint16_t>((m_nextColour + 1) % m_coloursCount);
+
+	Chunk NewChunk;
+	NewChunk.m_data = AllocateChunkMemory(colourOffset) + colourOffset;
+	NewChunk.m_colourOffset = static_cast<uint16_t>(colourOffset);
+	NewChunk.m_freeBitmap = nullptr;
+	if (m_freeTracking == FreeTracking::BITMAP)
+	{
+		NewChunk.m_freeBitmap = static_cast<uint64_t*>(std::malloc(Chunk::BitmapWords(m_numBlocks) * sizeof(uint64_t)));
+		if (!NewChunk.m_freeBitmap)
+		{
+			ReleaseChunkMemory(NewChunk);
+			throw std::bad_alloc();
 		}
 	}
+	NewChunk.Init(NewChunk.m_data, m_blockSize, m_numBlocks, m_freeTracking);
+	NewChunk.m_prevInList = NewChunk.m_nextInList = NO_CHUNK;
+	NewChunk.m_index = static_cast<uint32_t>(m_chunks.size());
+	NewChunk.m_emptySince = 0;
+	NewChunk.m_list = NO_LIST;
 	
-	assert(m_lastChunkUsedForAllocation != 0);
-	assert(m_lastChunkUsedForAllocation->m_blocksAvailable > 0);
+	m_chunks.push_back(NewChunk);
+	++m_chunksCreated;
+	SHIRO_MM_TRACE3(chunk_create, m_blockSize, NewChunk.m_index, m_chunks.size());
+	m_lastChunkUsedForAllocation = &m_chunks.back();
+	if (!m_lastChunkUsedForDeallocation)
+	{
+		m_lastChunkUsedForDeallocation = m_lastChunkUsedForAllocation;
+	}
+}
+
+unsigned char FixedAllocator::GetListFor(const Chunk& chunk) const
+{
+	if (chunk.m_blocksAvailable == 0) return FULL_LIST;
+	if (chunk.m_blocksAvailable == m_numBlocks) return EMPTY_LIST;
+
+	//the more blocks are used, the lower the bin
+	const size_t usedBlocks = m_numBlocks - chunk.m_blocksAvailable;
+	return static_cast<unsigned char>(PARTIAL_BINS - 1 - (usedBlocks * PARTIAL_BINS) / m_numBlocks);
+}
+
+void FixedAllocator::LinkChunk(uint32_t index, unsigned char list)
+{
+	assert(list < LISTS_COUNT);
+	Chunk& chunk = m_chunks[index];
+	assert(chunk.m_list == NO_LIST);
+
+	//push front
+	chunk.m_list = list;
+	chunk.m_prevInList = NO_CHUNK;
+	chunk.m_nextInList = m_chunkLists[list].head;
+	if (chunk.m_nextInList != NO_CHUNK)
+	{
+		m_chunks[chunk.m_nextInList].m_prevInList = index;
+	}
+	else
+	{
+		m_chunkLists[list].tail = index;
+	}
+	m_chunkLists[list].head = index;
+	++m_chunkLists[list].size;
+}
+
+void FixedAllocator::UnlinkChunk(uint32_t index)
+{
+	Chunk& chunk = m_chunks[index];
+	assert(chunk.m_list < LISTS_COUNT);
+
+	if (chunk.m_prevInList != NO_CHUNK)
+	{
+		m_chunks[chunk.m_prevInList].m_nextInList = chunk.m_nextInList;
+	}
+	else
+	{
+		m_chunkLists[chunk.m_list].head = chunk.m_nextInList;
+	}
+	if (chunk.m_nextInList != NO_CHUNK)
+	{
+		m_chunks[chunk.m_nextInList].m_prevInList = chunk.m_prevInList;
+	}
+	else
+	{
+		m_chunkLists[chunk.m_list].tail = chunk.m_prevInList;
+	}
+	--m_chunkLists[chunk.m_list].size;
+
+	chunk.m_prevInList = chunk.m_nextInList = NO_CHUNK;
+	chunk.m_list = NO_LIST;
+}
+
+void FixedAllocator::ReleaseChunk(uint32_t index)
+{
+	assert(&m_chunks[index] != m_lastChunkUsedForAllocation);
+
+	UnlinkChunk(index);
+	ReleaseChunkMemory(m_chunks[index]);
+	++m_chunksDestroyed;
+	SHIRO_MM_TRACE3(chunk_release, m_blockSize, index, m_chunks.size());
+
+	const uint32_t lastIndex = static_cast<uint32_t>(m_chunks.size() - 1);
+	if (index != lastIndex)
+	{
+		//move the last chunk in the released slot and fix everything pointing to it
+		Chunk& moved = m_chunks[index];
+		moved = m_chunks[lastIndex];
+		moved.m_index = index;
+		if (moved.m_list != NO_LIST)
+		{
+			if (moved.m_prevInList != NO_CHUNK) m_chunks[moved.m_prevInList].m_nextInList = index;
+			else m_chunkLists[moved.m_list].head = index;
+			if (moved.m_nextInList != NO_CHUNK) m_chunks[moved.m_nextInList].m_prevInList = index;
+			else m_chunkLists[moved.m_list].tail = index;
+		}
+		if (m_lastChunkUsedForAllocation == &m_chunks[lastIndex])
+		{
+			m_lastChunkUsedForAllocation = &moved;
+		}
+	}
+	m_chunks.pop_back();
 
-	return m_lastChunkUsedForAllocation->Allocate(m_blockSize);
+	//the released slot now hosts the moved chunk, unless the released chunk was the last one
+	m_lastChunkUsedForDeallocation = index < m_chunks.size() ? &m_chunks[index] : (m_chunks.empty() ? nullptr : &m_chunks.back());
+}
+
+size_t FixedAllocator::AllocateBatch(void** OutBlocks, size_t Count)
+{
+	size_t allocated = 0;
+	while (allocated < Count)
+	{
+		if (m_lastChunkUsedForAllocation == 0 || m_lastChunkUsedForAllocation->m_blocksAvailable == 0)
+		{
+			FindChunkForAllocation();
+		}
+		
+		assert(m_lastChunkUsedForAllocation != 0);
+		assert(m_lastChunkUsedForAllocation->m_blocksAvailable > 0);
+
+		//drain as many blocks as possible from the selected chunk
+		allocated += m_freeTracking == FreeTracking::BITMAP
+			? m_lastChunkUsedForAllocation->AllocateBatchFromBitmap(m_blockSize, OutBlocks + allocated, Count - allocated)
+			: m_lastChunkUsedForAllocation->AllocateBatch(m_blockSize, OutBlocks + allocated, Count - allocated);
+	}
+	return allocated;
 }
 
 void FixedAllocator::Deallocate(void* ptr)
 {
 	assert(!m_chunks.empty());
-	assert(&m_chunks.front() <= m_lastChunkUsedForDeallocation);
-	assert(&m_chunks.back() >= m_lastChunkUsedForDeallocation);
+	assert(m_lastChunkUsedForDeallocation);
+	assert(m_lastChunkUsedForDeallocation == &m_chunks[m_lastChunkUsedForDeallocation->m_index]);
 
 	m_lastChunkUsedForDeallocation = FindInVicinity(ptr);
 	assert(m_lastChunkUsedForDeallocation);
@@ -208,18 +448,72 @@ void FixedAllocator::Deallocate(void* ptr)
 	DeallocateImpl(ptr);
 }
 
+void FixedAllocator::DeallocateBatch(void* const* Blocks, size_t Count)
+{
+	assert(!m_chunks.empty());
+
+	for (size_t i = 0; i < Count; ++i)
+	{
+		//blocks allocated together usually lie in the same chunk, search only when we leave it
+		//DeallocateImpl may swap or release chunks, so the range is checked again at every step
+		if (!IsInChunk(m_lastChunkUsedForDeallocation, Blocks[i]))
+		{
+			m_lastChunkUsedForDeallocation = FindInVicinity(Blocks[i]);
+			assert(m_lastChunkUsedForDeallocation);
+		}
+
+		DeallocateImpl(Blocks[i]);
+	}
+}
+
+void FixedAllocator::DeallocateRemote(void* ptr)
+{
+	assert(ptr);
+	assert(m_blockSize >= sizeof(void*)); //block must be able to host the link to the next remotely released block
+
+	//push ptr on top of the remote free list. Block may be unaligned for a pointer, hence memcpy
+	void* head = m_remoteFreeList.load(std::memory_order_relaxed);
+	do
+	{
+		std::memcpy(ptr, &head, sizeof(void*));
+	} while (!m_remoteFreeList.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+}
+
+size_t FixedAllocator::DrainRemoteFrees()
+{
+	if (m_remoteFreeList.load(std::memory_order_relaxed) == nullptr) return 0; //nothing to do, avoid the atomic exchange
+
+	//detach the whole list at once, foreign threads will keep pushing on an empty one
+	void* it = m_remoteFreeList.exchange(nullptr, std::memory_order_acquire);
+	
+	size_t reclaimed = 0;
+	while (it)
+	{
+		void* next;
+		std::memcpy(&next, it, sizeof(void*));
+		Deallocate(it);
+		it = next;
+		++reclaimed;
+	}
+	return reclaimed;
+}
+
 void FixedAllocator::Release()
 {
 	//clear memory allocated for this FixedAllocator chunks
-	for (Chunks::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+	for (size_t i = 0; i < m_chunks.size(); ++i)
 	{
-		it->Release();
+		ReleaseChunkMemory(m_chunks[i]);
 	}
+	m_chunksDestroyed += m_chunks.size();
 	m_chunks.clear(); //remove all chunks
 
 	//reset addresses
 	m_lastChunkUsedForAllocation = nullptr;
 	m_lastChunkUsedForDeallocation = nullptr;
+	std::fill(m_chunkLists, m_chunkLists + LISTS_COUNT, ChunkList());
+	//blocks still in remote list belonged to the chunks we just released
+	m_remoteFreeList.store(nullptr, std::memory_order_relaxed);
 
 	prev = nullptr;
 	next = nullptr;
@@ -232,47 +526,89 @@ void FixedAllocator::DeallocateImpl(void* ptr)
 	assert(m_lastChunkUsedForDeallocation->m_data + (m_numBlocks * m_blockSize) > ptr);
 
 	//we're not releasing memory here, only clearing the block pointed by ptr 
-	m_lastChunkUsedForDeallocation->Deallocate(ptr, m_blockSize);
+	if (m_freeTracking == FreeTracking::BITMAP)
+	{
+		m_lastChunkUsedForDeallocation->DeallocateToBitmap(ptr, m_blockSize);
+		assert(m_lastChunkUsedForDeallocation->CountFreeInBitmap(m_numBlocks) == m_lastChunkUsedForDeallocation->m_blocksAvailable);
+	}
+	else
+	{
+		m_lastChunkUsedForDeallocation->Deallocate(ptr, m_blockSize);
+	}
 
-	if (m_lastChunkUsedForDeallocation->m_blocksAvailable == m_numBlocks) //Last Chunk used for deallocation now is empty
+	//the chunk used for allocation is out of every list, nothing to update
+	if (m_lastChunkUsedForDeallocation == m_lastChunkUsedForAllocation) return;
+
+	const unsigned char list = GetListFor(*m_lastChunkUsedForDeallocation);
+	if (list == m_lastChunkUsedForDeallocation->m_list) return; //still in the right bin
+
+	const uint32_t index = GetChunkIndex(m_lastChunkUsedForDeallocation);
+	UnlinkChunk(index);
+	LinkChunk(index, list);
+
+	if (list == EMPTY_LIST)
 	{
-		//shall we release this chunk then?
-		//We release the chunk only if we find at least two empty Chunks
+		OnChunkEmptied(index);
+	}
+}
 
-		Chunk& lastChunkInList = m_chunks.back();
+void FixedAllocator::OnChunkEmptied(uint32_t index)
+{
+	ChunkList& emptyList = m_chunkLists[EMPTY_LIST];
 
-		//if the last chunk in list is also the one from which we just removed a block
-		if (&lastChunkInList == m_lastChunkUsedForDeallocation)
+	switch (m_retention.mode)
+	{
+	case ChunkRetentionPolicy::Mode::KEEP_N:
+		//the newest empty chunk is the head, it is the one just filed
+		while (emptyList.size > m_retention.keepEmpty)
+		{
+			ReleaseChunk(emptyList.head);
+		}
+		break;
+	case ChunkRetentionPolicy::Mode::WATERMARK:
+		//releasing in bursts keeps an oscillating workload from paying a malloc and a free per operation
+		if (emptyList.size > m_retention.highWatermark)
 		{
-			//we have to make sure there are two empty Chunks
-			//check list is not empty and also
-			//check previous chunk to m_lastChunkUsedForDeallocation is empty
-			if (m_chunks.size() > 1 && (m_lastChunkUsedForDeallocation - 1)->m_blocksAvailable == m_numBlocks)
+			while (emptyList.size > m_retention.lowWatermark)
 			{
-				m_lastChunkUsedForDeallocation->Release();
-				m_chunks.pop_back();
-				//reset pointers to a stable situation
-				m_lastChunkUsedForAllocation = m_lastChunkUsedForDeallocation = &m_chunks.front();
+				ReleaseChunk(emptyList.head);
 			}
-
-			return; //we're done
 		}
+		break;
+	case ChunkRetentionPolicy::Mode::TIME_BASED:
+		m_chunks[index].m_emptySince = GetTimeMs();
+		TrimEmptyChunks();
+		break;
+	}
+}
 
-		//if not then check the last chunk in list anyway
-		if (lastChunkInList.m_blocksAvailable == m_numBlocks)
-		{
-			//if it is empty then we got two non-contiguous empty Chunk, release the last one in list
-			lastChunkInList.Release();
-			m_chunks.pop_back();
-			m_lastChunkUsedForAllocation = m_lastChunkUsedForDeallocation;
-		}
-		else
+void FixedAllocator::TrimEmptyChunks()
+{
+	if (m_retention.mode != ChunkRetentionPolicy::Mode::TIME_BASED)
+	{
+		//count based policies are always satisfied once the list is within its lower bound
+		const size_t keep = m_retention.mode == ChunkRetentionPolicy::Mode::KEEP_N ? m_retention.keepEmpty : m_retention.lowWatermark;
+		while (m_chunkLists[EMPTY_LIST].size > keep)
 		{
-			//we didn't find a second empty chunk, swap this empty chunk with the last in list
-			std::swap(*m_lastChunkUsedForDeallocation, lastChunkInList);
-			m_lastChunkUsedForAllocation = &m_chunks.back();
+			ReleaseChunk(m_chunkLists[EMPTY_LIST].head);
 		}
+		return;
 	}
+
+	//chunks are pushed in front when they become empty, so the list goes from the newest to the oldest.
+	//expired chunks are popped from the tail, the first one still fresh ends the trim
+	const uint64_t now = GetTimeMs();
+	const ChunkList& emptyList = m_chunkLists[EMPTY_LIST];
+	while (emptyList.tail != NO_CHUNK && now - m_chunks[emptyList.tail].m_emptySince > m_retention.maxIdleMs)
+	{
+		ReleaseChunk(emptyList.tail);
+	}
+}
+
+uint64_t FixedAllocator::GetTimeMs()
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
 }
 
 FixedAllocator::Chunk* FixedAllocator::FindInVicinity(void* ptr)
@@ -280,47 +616,89 @@ FixedAllocator::Chunk* FixedAllocator::FindInVicinity(void* ptr)
 	assert(!m_chunks.empty());
 	assert(m_lastChunkUsedForDeallocation);
 
-	const size_t ChunkMaxCapacity = m_numBlocks * m_blockSize;
-
-	//start to search in the interval [front, back + 1]
-	Chunk* left = m_lastChunkUsedForDeallocation;
-	Chunk* right = m_lastChunkUsedForDeallocation + 1;
-	Chunk* left_bound = &m_chunks.front();
-	Chunk* right_bound = &m_chunks.back() + 1;
-
-	if (right == right_bound)
-		right = 0;
+	//chunks are not contiguous, walk indices outward from the last chunk used for deallocation
+	const size_t count = m_chunks.size();
+	size_t left = m_lastChunkUsedForDeallocation->m_index;
+	size_t right = left + 1;
+	bool searchLeft = true;
+	bool searchRight = right < count;
 
-	for (;;)
+	while (searchLeft || searchRight)
 	{
-		if (left == 0 && right == 0) //if the ptr has not been found exit
-			break;
-
 		//check if ptr is pointing to a block inside a Chunk that 
 		//is equal or precedes the m_lastChunkUsedForDeallocation
-		if (left)
+		if (searchLeft)
 		{
-			if (ptr >= left->m_data && ptr < left->m_data + ChunkMaxCapacity)
+			Chunk* chunk = &m_chunks[left];
+			if (IsInChunk(chunk, ptr))
 			{
-				return left;
+				return chunk;
 			}
-			if (left == left_bound) //we're at the start of the Chunk
-				left = 0;
+			if (left == 0) //we're at the first Chunk
+				searchLeft = false;
 			else --left;
 		}
 
-		if (right)
+		if (searchRight)
 		{
-			if (ptr >= right->m_data && ptr < right->m_data + ChunkMaxCapacity)
+			Chunk* chunk = &m_chunks[right];
+			if (IsInChunk(chunk, ptr))
 			{
-				return right;
+				return chunk;
 			}
 			++right;
-			if (right == right_bound) //we're at the end of the Chunk
-				right = 0;
+			if (right == count) //we're at the last Chunk
+				searchRight = false;
 		}
 	}
 
 	assert(false); //signal that there's a problem if we ended up here
 	return 0;
 }
+
+unsigned char* FixedAllocator::AllocateChunkMemory(size_t ColourOffset)
+{
+	//the choice depends only on sizes, so ReleaseChunkMemory can tell where the memory came from.
+	//colour offsets never exceed the slack, a coloured chunk still fits a slab piece
+	void* data = UsesSlabProvider()
+		? mp_slabProvider->Allocate()
+		: std::malloc(m_numBlocks * m_blockSize + ColourOffset); //reserve heap memory for the chunk. 
+	if (!data) { throw std::bad_alloc(); }
+	return static_cast<unsigned char*>(data);
+}
+
+void FixedAllocator::ReleaseChunkMemory(Chunk& chunk)
+{
+	assert(chunk.m_data != nullptr);
+	std::free(chunk.m_freeBitmap); //nullptr unless FreeTracking::BITMAP
+	if (UsesSlabProvider())
+	{
+		mp_slabProvider->Deallocate(chunk.m_data - chunk.m_colourOffset);
+		return;
+	}
+	std::free(chunk.m_data - chunk.m_colourOffset);
+}
+
+MemoryFootprint FixedAllocator::GetMemoryFootprint() const
+{
+	MemoryFootprint footprint;
+	const size_t chunkBytes = m_numBlocks * m_blockSize;
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		footprint.freeBytes += m_chunks[i].m_blocksAvailable * m_blockSize;
+		footprint.wastedBytes += m_chunks[i].m_colourOffset;
+	}
+	footprint.allocatedBytes = m_chunks.size() * chunkBytes - footprint.freeBytes;
+	footprint.metadataBytes = sizeof(FixedAllocator) + m_chunks.capacity() * sizeof(Chunk);
+	if (m_freeTracking == FreeTracking::BITMAP)
+	{
+		footprint.metadataBytes += m_chunks.size() * Chunk::BitmapWords(m_numBlocks) * sizeof(uint64_t);
+	}
+	if (UsesSlabProvider())
+	{
+		//a chunk holds at most UCHAR_MAX blocks, the rest of its slab piece is never used
+		//colour offsets are part of that tail
+		footprint.wastedBytes = m_chunks.size() * (mp_slabProvider->GetPieceSize() - chunkBytes);
+	}
+	return footprint;
+}
@@ -1,56 +1,304 @@
 #pragma once
-#include <vector>
-#include "Mallocator.h"
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include "SegmentedVector.h"
+#include "BitOps.h"
+#include "PageAllocator.h"
+#include "MemoryFootprint.h"
 
 constexpr size_t DEFAULT_CHUNK_SIZE = 4096;
 
+/** When chunks left empty by deallocations are given back to the system */
+struct ChunkRetentionPolicy
+{
+	enum class Mode
+	{
+		/** Keep at most keepEmpty empty chunks, release the others as soon as they become empty */
+		KEEP_N,
+		/** Let empty chunks pile up to highWatermark, then release them down to lowWatermark at once */
+		WATERMARK,
+		/** Release chunks left empty for more than maxIdleMs. Checked whenever a chunk becomes empty or on TrimEmptyChunks */
+		TIME_BASED
+	};
+
+	Mode mode = Mode::KEEP_N;
+	size_t keepEmpty = 1;
+	size_t highWatermark = 8;
+	size_t lowWatermark = 2;
+	uint32_t maxIdleMs = 1000;
+};
+
+/** Chunk lifetime counters, to spot allocators that keep creating and destroying chunks */
+struct ChunkStats
+{
+	size_t created = 0;
+	size_t destroyed = 0;
+	size_t live = 0;
+	size_t empty = 0;
+};
+
 class FixedAllocator
 {
 public:
-	explicit FixedAllocator(size_t ChunkSize = 0, size_t BlockSize = 0);
+	/** How a Chunk keeps track of its free blocks */
+	enum class FreeTracking
+	{
+		/** Index of the next free block stored in the first byte of each free block */
+		FREE_LIST,
+		/** Out-of-line bitmap, allocated per Chunk and only in this mode, free blocks are never touched */
+		BITMAP
+	};
+
+	/** Chunk colours are spaced by a cache line, which keeps every block as aligned as without colouring */
+	static constexpr size_t COLOUR_STEP = 64;
+	/** A page worth of colours already spreads a block index over every set of a page indexed cache */
+	static constexpr size_t MAX_COLOURS = 64;
+
+	/** 
+	 * When SlabProvider is given, chunks fitting its pieces are carved from its slabs instead of being malloc'd one by one.
+	 * With Colouring, the first block of each new chunk is shifted by a rotating multiple of COLOUR_STEP within the chunk slack,
+	 * so the same block index of different chunks does not always fall in the same cache set
+	 */
+	explicit FixedAllocator(size_t ChunkSize = 0, size_t BlockSize = 0, FreeTracking Tracking = FreeTracking::FREE_LIST, const ChunkRetentionPolicy& Retention = ChunkRetentionPolicy(),
+		ChunkSlabProvider* SlabProvider = nullptr, bool Colouring = false);
 	FixedAllocator(const FixedAllocator& other);
 	FixedAllocator& operator=(const FixedAllocator& other);
 	~FixedAllocator();
 
 	void Swap(FixedAllocator& other);
 
-	void* Allocate();
+	/** Fast path is inlined: unless the last chunk used is full, allocation is a pop from its free list or a bit scan */
+	inline void* Allocate()
+	{
+		if (m_lastChunkUsedForAllocation == 0 || m_lastChunkUsedForAllocation->m_blocksAvailable == 0)
+		{
+			FindChunkForAllocation();
+		}
+
+		assert(m_lastChunkUsedForAllocation != 0);
+		assert(m_lastChunkUsedForAllocation->m_blocksAvailable > 0);
+
+		return m_freeTracking == FreeTracking::BITMAP
+			? m_lastChunkUsedForAllocation->AllocateFromBitmap(m_blockSize)
+			: m_lastChunkUsedForAllocation->Allocate(m_blockSize);
+	}
 	void Deallocate(void* ptr);
+	/** Fill OutBlocks with Count blocks, popping whole runs out of each Chunk free list. Returns the number of allocated blocks */
+	size_t AllocateBatch(void** OutBlocks, size_t Count);
+	/** Release Count blocks. Chunk lookup is performed only when a block does not belong to the Chunk of the previous one */
+	void DeallocateBatch(void* const* Blocks, size_t Count);
+	/**
+	 * Thread-safe. Releases a block from a thread that does not own this allocator.
+	 * The block is pushed on a lock-free list and given back to its Chunk by the owner on its next slow path.
+	 * Block size must be large enough to host a pointer
+	 */
+	void DeallocateRemote(void* ptr);
+	/** Give back to their Chunks all the blocks released by other threads. Returns the number of reclaimed blocks */
+	size_t DrainRemoteFrees();
 
 	void Release();
+	/** Release the empty chunks exceeding the retention policy. Time based policies need it to age idle allocators */
+	void TrimEmptyChunks();
+
+	/**
+	 * Invoke func on every block currently allocated, chunk by chunk and in address order inside each chunk.
+	 * Blocks released by foreign threads are taken back first. func must not allocate or deallocate from this allocator
+	 */
+	template <typename Func>
+	void ForEachAllocatedBlock(Func&& func)
+	{
+		DrainRemoteFrees();
+
+		for (size_t c = 0; c < m_chunks.size(); ++c)
+		{
+			Chunk* it = &m_chunks[c];
+			if (m_freeTracking == FreeTracking::BITMAP)
+			{
+				//allocated blocks are the zero bits, only metadata is read
+				for (unsigned char w = 0; w < Chunk::BitmapWords(m_numBlocks); ++w)
+				{
+					uint64_t allocated = ~it->m_freeBitmap[w] & Chunk::ValidBits(w, m_numBlocks);
+					while (allocated)
+					{
+						const unsigned bit = CountTrailingZeros(allocated);
+						allocated &= allocated - 1;
+						func(static_cast<void*>(it->m_data + (w * 64 + bit) * m_blockSize));
+					}
+				}
+				continue;
+			}
+
+			//mark free blocks walking the chunk free list, every other block is allocated
+			bool isFree[UCHAR_MAX] = {};
+			unsigned char freeBlock = it->m_firstAvailableBlock;
+			for (unsigned char i = 0; i < it->m_blocksAvailable; ++i)
+			{
+				isFree[freeBlock] = true;
+				freeBlock = it->m_data[freeBlock * m_blockSize];
+			}
+
+			for (unsigned char i = 0; i < m_numBlocks; ++i)
+			{
+				if (!isFree[i])
+				{
+					func(static_cast<void*>(it->m_data + i * m_blockSize));
+				}
+			}
+		}
+	}
 
 	inline size_t GetBlockSize() const { return m_blockSize; }
+	/** Distinct offsets the first block of a chunk can start at, 1 without colouring */
+	inline size_t GetColoursCount() const { return m_coloursCount; }
 	inline size_t GetTotalAllocatedMemory() const { return m_chunks.size() * (GetBlockSize() * m_numBlocks);  }
+	/** Blocks released by foreign threads and not drained yet are still counted as allocated */
+	MemoryFootprint GetMemoryFootprint() const;
+	inline ChunkStats GetChunkStats() const
+	{
+		ChunkStats stats;
+		stats.created = m_chunksCreated;
+		stats.destroyed = m_chunksDestroyed;
+		stats.live = m_chunks.size();
+		stats.empty = m_chunkLists[EMPTY_LIST].size;
+		return stats;
+	}
 private:
 	/*Ensure Chunk is known only by a FixedAllocator*/
 	struct Chunk
 	{
-		void Init(size_t blockSize, unsigned char blocks);
-		void* Allocate(size_t blockSize);
+		/*64 bit words needed to track the blocks of a chunk*/
+		static inline unsigned char BitmapWords(unsigned char blocks)
+		{
+			return static_cast<unsigned char>((blocks + 63) / 64);
+		}
+		/*Mask of the bits of word w mapping to one of the blocks of the chunk*/
+		static inline uint64_t ValidBits(unsigned char w, unsigned char blocks)
+		{
+			const size_t first = static_cast<size_t>(w) * 64;
+			if (blocks <= first) return 0;
+			const size_t count = blocks - first;
+			return count >= 64 ? ~0ULL : ((1ULL << count) - 1);
+		}
+
+		void Init(unsigned char* data, size_t blockSize, unsigned char blocks, FreeTracking tracking);
+		inline void* Allocate(size_t blockSize)
+		{
+			if (m_blocksAvailable == 0) return nullptr;
+
+			assert((m_firstAvailableBlock * blockSize) / blockSize == m_firstAvailableBlock); //overflow check
+
+			unsigned char* result = m_data + (m_firstAvailableBlock * blockSize); //simple arithmetic operation to find new block start
+			m_firstAvailableBlock = *result; //copy index of next available block contained in result
+
+			--m_blocksAvailable; //decrement available blocks in chunk
+
+			return result;
+		}
+		inline void* AllocateFromBitmap(size_t blockSize)
+		{
+			if (m_blocksAvailable == 0) return nullptr;
+
+			//find the first word with a free block, then its lowest set bit
+			unsigned char w = 0;
+			while (m_freeBitmap[w] == 0) ++w;
+
+			const unsigned bit = CountTrailingZeros(m_freeBitmap[w]);
+			m_freeBitmap[w] &= m_freeBitmap[w] - 1; //clear lowest set bit
+
+			--m_blocksAvailable;
+
+			return m_data + ((w * 64 + bit) * blockSize);
+		}
+		size_t AllocateBatch(size_t blockSize, void** OutBlocks, size_t Count);
+		size_t AllocateBatchFromBitmap(size_t blockSize, void** OutBlocks, size_t Count);
 		void Deallocate(void* p, size_t blockSize);
-		void Reset(size_t blockSize, unsigned char blocks);
-		void Release();
+		void DeallocateToBitmap(void* p, size_t blockSize);
+		void Reset(size_t blockSize, unsigned char blocks, FreeTracking tracking);
+		/*Free blocks according to the bitmap, debug builds cross-check it against m_blocksAvailable*/
+		unsigned CountFreeInBitmap(unsigned char blocks) const;
 		unsigned char* m_data;
 		unsigned char
 			m_firstAvailableBlock,
 			m_blocksAvailable;
+		/*Bit set means free block. Allocated only with FreeTracking::BITMAP, nullptr otherwise*/
+		uint64_t* m_freeBitmap;
+		/*Intrusive links, as chunk indices, inside the list identified by m_list*/
+		uint32_t m_prevInList, m_nextInList;
+		/*Position of the chunk inside m_chunks*/
+		uint32_t m_index;
+		/*When the chunk entered the empty list, in ms. Used only with ChunkRetentionPolicy::Mode::TIME_BASED*/
+		uint64_t m_emptySince;
+		unsigned char m_list;
+		/*Bytes between the chunk memory and its first block*/
+		uint16_t m_colourOffset;
+	};
+
+	/*Chunks are grouped by fullness. Partial chunks are split in bins, bin 0 holding the fullest ones*/
+	static constexpr unsigned char PARTIAL_BINS = 4;
+	static constexpr unsigned char FULL_LIST = PARTIAL_BINS;
+	static constexpr unsigned char EMPTY_LIST = PARTIAL_BINS + 1;
+	static constexpr unsigned char LISTS_COUNT = PARTIAL_BINS + 2;
+	/*The chunk used for allocation is kept out of every list, so the allocation fast path never relinks it*/
+	static constexpr unsigned char NO_LIST = LISTS_COUNT;
+	static constexpr uint32_t NO_CHUNK = UINT32_MAX;
+
+	struct ChunkList
+	{
+		uint32_t head = NO_CHUNK;
+		/*Oldest chunk of the list, chunks are pushed in front*/
+		uint32_t tail = NO_CHUNK;
+		size_t size = 0;
 	};
 
+	/*Make m_lastChunkUsedForAllocation point to a Chunk with at least one available block, creating it if needed*/
+	void FindChunkForAllocation();
 	void DeallocateImpl(void* ptr);
 	Chunk* FindInVicinity(void* ptr);
+	/*List a chunk belongs to, according to its available blocks*/
+	unsigned char GetListFor(const Chunk& chunk) const;
+	void LinkChunk(uint32_t index, unsigned char list);
+	void UnlinkChunk(uint32_t index);
+	/*Release the chunk memory and remove it from the chunks, moving the last chunk in its place*/
+	void ReleaseChunk(uint32_t index);
+	/*Apply the retention policy to the empty list. Called every time a chunk becomes empty*/
+	void OnChunkEmptied(uint32_t index);
+	static uint64_t GetTimeMs();
+	/*Chunk memory comes from the slab provider when it fits its pieces, from malloc otherwise. ColourOffset bytes are reserved before the blocks*/
+	unsigned char* AllocateChunkMemory(size_t ColourOffset);
+	void ReleaseChunkMemory(Chunk& chunk);
+	inline bool UsesSlabProvider() const { return mp_slabProvider && m_numBlocks * m_blockSize <= mp_slabProvider->GetPieceSize(); }
+	inline uint32_t GetChunkIndex(const Chunk* chunk) const { return chunk->m_index; }
+	inline bool IsInChunk(const Chunk* chunk, const void* ptr) const { return ptr >= chunk->m_data && ptr < chunk->m_data + (m_numBlocks * m_blockSize); }
 
 	/*The fixed chunk's block size for this instance of FixedAllocator*/
 	size_t m_blockSize;
 	/*How many blocks a Chunk can contain*/
 	unsigned char m_numBlocks;
+	/*How chunks track their free blocks*/
+	FreeTracking m_freeTracking;
+	/*How many empty chunks are kept around*/
+	ChunkRetentionPolicy m_retention;
+	size_t m_chunksCreated = 0;
+	size_t m_chunksDestroyed = 0;
+	/*Optional source of chunk memory, not owned*/
+	ChunkSlabProvider* mp_slabProvider = nullptr;
+	/*Colour offsets available in the chunk slack, and the colour of the next chunk*/
+	uint16_t m_coloursCount = 1;
+	uint16_t m_nextColour = 0;
 
-	using Chunks = std::vector<Chunk, Mallocator<Chunk>>;
+	/*Chunks never move when a new one is added, so cached Chunk pointers survive growth*/
+	using Chunks = SegmentedVector<Chunk>;
 	/* All the chunks allocated for this instance of FixedAllocator*/
 	Chunks m_chunks;
-	/*The last chunk in which we allocated a block*/
+	/*Partial bins, full and empty chunks lists*/
+	ChunkList m_chunkLists[LISTS_COUNT];
+	/*The last chunk in which we allocated a block. It does not belong to any list*/
 	Chunk* m_lastChunkUsedForAllocation = nullptr;
 	/*The last chunk in which we released a block*/
 	Chunk* m_lastChunkUsedForDeallocation = nullptr;
+	/*Lock-free MPSC stack of blocks released by foreign threads. Each block stores the address of the next one*/
+	std::atomic<void*> m_remoteFreeList;
 
 	//boost and ensure copy semantics
 	mutable const FixedAllocator* prev = nullptr;
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "FreeListAllocator.h"
+#include "Tracepoints.h"
 
 namespace {
 	/** Given an address it computes its padding taking into account the passed alignment */
@@ -26,15 +27,23 @@ namespace {
 
 }
 
-FreeListAllocator::FreeListAllocator(size_t TotalSize, FitPolicy policy)
-	: m_totalSizeAllocated(TotalSize), m_policy(policy)
+FreeListAllocator::FreeListAllocator(size_t TotalSize, FitPolicy policy, bool HugePages /* = false */)
+	: m_totalSizeAllocated(TotalSize), m_policy(policy), m_hugePages(HugePages)
 {
 	Reset();
 }
 
 void FreeListAllocator::Release()
 {
-	free(mp_start);
+	if (m_hugePages)
+	{
+		PageAllocator::Unmap(m_mapping);
+		m_mapping = PageAllocator::Mapping();
+	}
+	else
+	{
+		free(mp_start);
+	}
 	mp_start = nullptr;
 }
 
@@ -50,7 +59,16 @@ void FreeListAllocator::Reset()
 		Release();
 	}
 
-	mp_start = malloc(m_totalSizeAllocated);
+	if (m_hugePages)
+	{
+		//the mapping may be rounded up to the huge page size, the pool keeps its nominal size
+		m_mapping = PageAllocator::Map(m_totalSizeAllocated, true);
+		mp_start = m_mapping.ptr;
+	}
+	else
+	{
+		mp_start = malloc(m_totalSizeAllocated);
+	}
 
 	//interpret allocated memory as a unique big Node
 	Node* head = static_cast<Node*>(mp_start);
@@ -61,11 +79,14 @@ void FreeListAllocator::Reset()
 	head->next = nullptr;
 	m_freeList.head = nullptr;
 	m_freeList.insert(nullptr, head);
+	m_liveBlocks = 0;
+	m_livePadding = 0;
 }
 
 void* FreeListAllocator::Allocate(size_t AllocationSize, size_t alignment, size_t& OutAllocationSize)
 {
 	assert(AllocationSize > 0 && alignment > 0 && "Allocation Size and Alignment must be positive");
+	assert((alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
 	
 	static constexpr size_t allocationHeaderSize = sizeof(FreeListAllocator::AllocatedBlockHeader);
 
@@ -76,13 +97,38 @@ void* FreeListAllocator::Allocate(size_t AllocationSize, size_t alignment, size_
 	
 	Find(AllocationSize, alignment, OutNewAddressPadding, OutPrevNode, OutResultNode);
 	
-	assert(OutResultNode && "Not enough Memory for any new Block");
+	if (!OutResultNode) //not enough memory for any new block, let the caller decide
+	{
+		OutAllocationSize = 0;
+		return nullptr;
+	}
 
 	//OutNewAddressPadding contains both 
 	//subtract AllocatedBlockHeader size to get just the alignment padding
-	const size_t alignmentPadding = OutNewAddressPadding - allocationHeaderSize; 
-	//required size is (RequestedAllocationSize + Padding)
-	const size_t requiredSize = AllocationSize + OutNewAddressPadding;
+	size_t alignmentPadding = OutNewAddressPadding - allocationHeaderSize; 
+	if (alignmentPadding >= sizeof(Node))
+	{
+		//large alignments: split the leading remainder off as a free block, the allocated block starts at its header.
+		//padding is at least a node only when alignment exceeds it, so the header is aligned for a node as well
+		const size_t leadingNodeAddress = reinterpret_cast<size_t>(OutResultNode);
+		Node* alignedNode = reinterpret_cast<Node*>(leadingNodeAddress + alignmentPadding);
+		alignedNode->data.blockSize = OutResultNode->data.blockSize - alignmentPadding;
+		OutResultNode->data.blockSize = alignmentPadding;
+		m_freeList.insert(OutResultNode, alignedNode);
+
+		OutPrevNode = OutResultNode;
+		OutResultNode = alignedNode;
+		OutNewAddressPadding = allocationHeaderSize;
+		alignmentPadding = 0;
+	}
+	//required size is (RequestedAllocationSize + Padding), rounded to keep the following free node aligned
+	size_t requiredSize = AllocationSize + OutNewAddressPadding;
+	requiredSize = (requiredSize + alignof(Node) - 1) & ~(alignof(Node) - 1);
+	if (requiredSize > OutResultNode->data.blockSize || OutResultNode->data.blockSize - requiredSize < sizeof(Node))
+	{
+		//the remainder could not even host a free node header, hand out the whole block
+		requiredSize = OutResultNode->data.blockSize;
+	}
 
 	const size_t remainingBlockSize = OutResultNode->data.blockSize - requiredSize;
 	const size_t resNodeAddress = reinterpret_cast<size_t>(OutResultNode);
@@ -102,10 +148,12 @@ void* FreeListAllocator::Allocate(size_t AllocationSize, size_t alignment, size_
 	const size_t dataAddress = AllocatedBlockHeaderAddress + allocationHeaderSize;
 	AllocatedBlockHeader* _header = reinterpret_cast<AllocatedBlockHeader*>(AllocatedBlockHeaderAddress);
 	_header->blockSize = requiredSize;
-	_header->padding = static_cast<char>(alignmentPadding);
+	_header->padding = alignmentPadding;
 
 	assert(isAligned(dataAddress, alignment));
 
+	++m_liveBlocks;
+	m_livePadding += alignmentPadding;
 	OutAllocationSize = requiredSize;
 	return reinterpret_cast<void*>(dataAddress);
 }
@@ -123,7 +171,7 @@ size_t FreeListAllocator::Deallocate(void* ptr)
 	assert(allocatedBlockHeader != nullptr);
 	assert(allocatedBlockHeader->blockSize >= AllocationHeaderSize);
 
-	const size_t AlignmentPadding = static_cast<size_t>(allocatedBlockHeader->padding);
+	const size_t AlignmentPadding = allocatedBlockHeader->padding;
 	const size_t DeallocationSize = allocatedBlockHeader->blockSize;
 
 	//retrieve base address subtracting alignmentPadding e allocation header size from ptr
@@ -140,29 +188,76 @@ size_t FreeListAllocator::Deallocate(void* ptr)
 		}
 		prev = it;
 	}
+	if (it == nullptr)
+	{
+		m_freeList.insert(prev, freeNode); //block follows every free block, append it
+	}
 	//try to merge contiguous nodes into a unique free block
 	Coalescence(prev, freeNode);
 
+	--m_liveBlocks;
+	m_livePadding -= AlignmentPadding;
+
 	return DeallocationSize;
 }
+
+size_t FreeListAllocator::GetUsableSize(const void* ptr)
+{
+	static constexpr size_t AllocationHeaderSize = sizeof(AllocatedBlockHeader);
+
+	//the block spans from its base address to base + blockSize, data starts after padding and header
+	const AllocatedBlockHeader* allocatedBlockHeader = reinterpret_cast<const AllocatedBlockHeader*>(reinterpret_cast<size_t>(ptr) - AllocationHeaderSize);
+	const size_t AlignmentPadding = allocatedBlockHeader->padding;
+	assert(allocatedBlockHeader->blockSize > AlignmentPadding + AllocationHeaderSize);
+
+	return allocatedBlockHeader->blockSize - AlignmentPadding - AllocationHeaderSize;
+}
+
+MemoryFootprint FreeListAllocator::GetMemoryFootprint() const
+{
+	MemoryFootprint footprint;
+	for (const Node* it = m_freeList.head; it != nullptr; it = it->next)
+	{
+		footprint.freeBytes += it->data.blockSize;
+	}
+	footprint.metadataBytes = m_liveBlocks * sizeof(AllocatedBlockHeader);
+	footprint.wastedBytes = m_livePadding;
+	footprint.allocatedBytes = m_totalSizeAllocated - footprint.freeBytes - footprint.metadataBytes - footprint.wastedBytes;
+	if (m_hugePages && m_mapping.size > m_totalSizeAllocated)
+	{
+		//the pool keeps its nominal size inside a mapping rounded up to the huge page size
+		footprint.wastedBytes += m_mapping.size - m_totalSizeAllocated;
+	}
+	return footprint;
+}
  
 void FreeListAllocator::Coalescence(Node* prevBlock, Node* freeBlock)
 {
+	size_t merged = 0;
 	if (freeBlock->next != nullptr && (reinterpret_cast<size_t>(freeBlock) + freeBlock->data.blockSize) == reinterpret_cast<size_t>(freeBlock->next))
 	{
 		freeBlock->data.blockSize += freeBlock->next->data.blockSize;
 		m_freeList.remove(freeBlock, freeBlock->next);
+		++merged;
 	}
 
 	if (prevBlock != nullptr && (reinterpret_cast<size_t>(prevBlock) + prevBlock->data.blockSize) == reinterpret_cast<size_t>(freeBlock))
 	{
 		prevBlock->data.blockSize += freeBlock->data.blockSize;
 		m_freeList.remove(prevBlock, freeBlock);
+		freeBlock = prevBlock;
+		++merged;
+	}
+
+	if (merged > 0)
+	{
+		SHIRO_MM_TRACE3(freelist_coalesce, freeBlock, freeBlock->data.blockSize, merged);
 	}
 }
 
 void FreeListAllocator::Find(size_t InSize, size_t InAlignment, size_t& OutPadding, Node*& OutPreviousNode, Node*& OutFoundNode)
 {
+	SHIRO_MM_TRACE2(freelist_find_start, InSize, InAlignment);
 	switch (m_policy)
 	{
 	case FitPolicy::BEST_FIT:
@@ -172,6 +267,7 @@ void FreeListAllocator::Find(size_t InSize, size_t InAlignment, size_t& OutPaddi
 		FindFirst(InSize, InAlignment, OutPadding, OutPreviousNode, OutFoundNode);
 		break;
 	}
+	SHIRO_MM_TRACE2(freelist_find_done, InSize, OutFoundNode);
 }
 
 void FreeListAllocator::FindBest(size_t size, size_t alignment, size_t& padding, Node*& previousNode, Node*& resNode)
@@ -179,6 +275,7 @@ void FreeListAllocator::FindBest(size_t size, size_t alignment, size_t& padding,
 	// Iterate the whole list and return a ptr with the best fit
 	
 	Node* bestBlock = nullptr, *prevBest = nullptr;
+	size_t bestPadding = 0;
 	Node* it = m_freeList.head,
 		* prev = nullptr;
 	/** Current smallest difference (blockSize - requiredSize) among all FreeBlock blocks*/
@@ -191,10 +288,12 @@ void FreeListAllocator::FindBest(size_t size, size_t alignment, size_t& padding,
 			smallestDiff = it->data.blockSize - requiredSpace;
 			bestBlock = it;
 			prevBest = prev;
+			bestPadding = padding;
 		}
 		prev = it;
 	}
 	
+	padding = bestPadding; //padding depends on the node address, return the one of the best block
 	previousNode = prevBest;
 	resNode = bestBlock;
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include "PageAllocator.h"
+#include "MemoryFootprint.h"
 
 using std::size_t;
 
@@ -11,14 +13,29 @@ public:
 		FIRST_FIT
 	};
 	
-	FreeListAllocator(size_t TotalSize, FitPolicy policy);
+	/** With HugePages the pool is mapped with huge pages, when the system provides them */
+	FreeListAllocator(size_t TotalSize, FitPolicy policy, bool HugePages = false);
 	~FreeListAllocator();
 
+	/** 
+	 * Alignment must be a power of two, any size is supported (pages, huge pages).
+	 * When the aligned address leaves room for a free node before it, that leading remainder goes back to the free list
+	 */
 	void* Allocate(size_t AllocationSize, size_t alignment, size_t& OutAllocationSize);
 	size_t Deallocate(void* ptr);
 	void Reset();
+	/** Bytes the caller can use from ptr, padding and alignment slack of the block included */
+	static size_t GetUsableSize(const void* ptr);
 
 	inline size_t GetTotalAllocatedMemory() const { return m_totalSizeAllocated; }
+	/** Block headers are metadata, alignment padding in front of blocks is wasted. Walks the free list */
+	MemoryFootprint GetMemoryFootprint() const;
+	inline PageAllocator::Backing GetPageBacking() const { return m_mapping.backing; }
+	/** Whether ptr lies inside the memory pool of this allocator */
+	inline bool Contains(const void* ptr) const
+	{
+		return ptr >= mp_start && ptr < static_cast<const char*>(mp_start) + m_totalSizeAllocated;
+	}
 
 	/** Prevent copy for this class */
 	FreeListAllocator(const FreeListAllocator&) = delete;
@@ -88,7 +105,8 @@ private:
 	/** Internal struct identifying an allocated block */
 	struct AllocatedBlockHeader : FreeBlockHeader
 	{
-		char padding;
+		/** Bytes between the block start and the header. Kept in a full word, the header is padded to it anyway */
+		size_t padding;
 	};
 	using Node = ForwardLinkedList<FreeBlockHeader>::Node;
 	using FreeBlocks = ForwardLinkedList<FreeBlockHeader>;
@@ -99,8 +117,15 @@ private:
 	const size_t m_totalSizeAllocated;
 	/** Internal pointer pointing to the first address of the memory pool*/
 	void* mp_start = nullptr;
+	/** Pool is mapped through PageAllocator instead of malloc */
+	const bool m_hugePages;
+	/** Pool mapping, valid only with m_hugePages */
+	PageAllocator::Mapping m_mapping;
 	/** ForwardLinkedList tracking FreeBlock in list*/
 	FreeBlocks m_freeList;
+	/** Allocated blocks and the alignment padding in front of them, so their overhead is known without walking the pool */
+	size_t m_liveBlocks = 0;
+	size_t m_livePadding = 0;
 
 	FreeListAllocator(FreeListAllocator& freeListAllocator); //disable constructor
 
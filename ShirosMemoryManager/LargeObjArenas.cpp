@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "LargeObjArenas.h"
+#include <thread>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace {
+	/** CPU the calling thread is running on, or a value derived from the thread id where it cannot be queried */
+	size_t GetCurrentCpu()
+	{
+#ifdef _WIN32
+		return static_cast<size_t>(GetCurrentProcessorNumber());
+#elif defined(__linux__)
+		const int cpu = sched_getcpu();
+		if (cpu >= 0) return static_cast<size_t>(cpu);
+#endif
+		return std::hash<std::thread::id>()(std::this_thread::get_id());
+	}
+
+	/** Round robin index handed to each thread on its first request */
+	size_t GetThreadSlot()
+	{
+		static std::atomic<size_t> nextSlot(0);
+		thread_local const size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+		return slot;
+	}
+}
+
+LargeObjArenas::LargeObjArenas(size_t TotalSize, size_t ArenasCount, FreeListAllocator::FitPolicy Policy, ArenaSelection Selection /* = ArenaSelection::PER_CPU */, bool HugePages /* = false */)
+	: m_arenasCount(ArenasCount > 0 ? ArenasCount : std::max<size_t>(std::thread::hardware_concurrency(), 1)),
+	m_arenaSize(TotalSize / m_arenasCount),
+	m_selection(Selection)
+{
+	assert(m_arenaSize > 0);
+
+	//memory manager overrides global new, arenas are placed in raw memory
+	mp_storage = std::malloc(m_arenasCount * sizeof(Arena) + alignof(Arena));
+	if (!mp_storage) { throw std::bad_alloc(); }
+	mp_arenas = reinterpret_cast<Arena*>((reinterpret_cast<size_t>(mp_storage) + alignof(Arena) - 1) & ~(alignof(Arena) - 1));
+
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		new(&mp_arenas[i]) Arena(m_arenaSize, Policy, HugePages);
+	}
+}
+
+LargeObjArenas::~LargeObjArenas()
+{
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		mp_arenas[i].~Arena();
+	}
+	std::free(mp_storage);
+}
+
+size_t LargeObjArenas::SelectArena() const
+{
+	if (m_arenasCount == 1) return 0;
+	return (m_selection == ArenaSelection::PER_CPU ? GetCurrentCpu() : GetThreadSlot()) % m_arenasCount;
+}
+
+size_t LargeObjArenas::FindArena(const void* ptr) const
+{
+	//arenas are a handful, a linear scan over their ranges is cheaper than any lookup structure
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		if (mp_arenas[i].allocator.Contains(ptr)) return i;
+	}
+	return m_arenasCount;
+}
+
+void* LargeObjArenas::Allocate(size_t AllocationSize, size_t Alignment, size_t& OutAllocationSize)
+{
+	const size_t first = SelectArena();
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		Arena& arena = mp_arenas[(first + i) % m_arenasCount];
+		std::lock_guard<std::mutex> guard(arena.lock);
+		void* p_res = arena.allocator.Allocate(AllocationSize, Alignment, OutAllocationSize);
+		if (p_res) return p_res;
+	}
+
+	OutAllocationSize = 0;
+	return nullptr;
+}
+
+size_t LargeObjArenas::Deallocate(void* ptr)
+{
+	const size_t index = FindArena(ptr);
+	assert(index < m_arenasCount && "Address does not belong to any arena");
+	if (index == m_arenasCount) return 0;
+
+	Arena& arena = mp_arenas[index];
+	std::lock_guard<std::mutex> guard(arena.lock);
+	return arena.allocator.Deallocate(ptr);
+}
+
+size_t LargeObjArenas::GetUsableSize(const void* ptr) const
+{
+	//the header of a live block is written only at allocation, no lock is needed to read it
+	return Contains(ptr) ? FreeListAllocator::GetUsableSize(ptr) : 0;
+}
+
+MemoryFootprint LargeObjArenas::GetMemoryFootprint()
+{
+	MemoryFootprint footprint;
+	footprint.metadataBytes = m_arenasCount * sizeof(Arena) + alignof(Arena);
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		std::lock_guard<std::mutex> guard(mp_arenas[i].lock);
+		footprint += mp_arenas[i].allocator.GetMemoryFootprint();
+	}
+	return footprint;
+}
+
+void LargeObjArenas::Reset()
+{
+	for (size_t i = 0; i < m_arenasCount; ++i)
+	{
+		mp_arenas[i].allocator.Reset();
+	}
+}
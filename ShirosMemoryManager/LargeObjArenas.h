@@ -0,0 +1,67 @@
+#pragma once
+#include <mutex>
+#include "FreeListAllocator.h"
+
+/**
+ * Set of independent FreeListAllocator arenas, each one guarded by its own lock.
+ * Threads allocate from the arena of the CPU they run on (or from an arena bound to the thread),
+ * so large object requests coming from different cores do not contend on a single free list.
+ * Every arena owns a distinct pool, frees are routed back to the owning arena by address range
+ */
+class LargeObjArenas
+{
+public:
+	enum class ArenaSelection
+	{
+		/** Arena of the CPU the calling thread is running on */
+		PER_CPU,
+		/** Arena assigned round robin to each thread on its first request */
+		PER_THREAD
+	};
+
+	/** TotalSize is split evenly among ArenasCount arenas. ArenasCount equal to 0 means one arena per hardware thread */
+	LargeObjArenas(size_t TotalSize, size_t ArenasCount, FreeListAllocator::FitPolicy Policy, ArenaSelection Selection = ArenaSelection::PER_CPU, bool HugePages = false);
+	~LargeObjArenas();
+
+	/** Prevent copy for this class */
+	LargeObjArenas(const LargeObjArenas&) = delete;
+	LargeObjArenas& operator=(const LargeObjArenas&) = delete;
+
+	/** Thread-safe. When the selected arena is exhausted the other arenas are tried in turn. Returns nullptr if none can serve the request */
+	void* Allocate(size_t AllocationSize, size_t Alignment, size_t& OutAllocationSize);
+	/** Thread-safe. Returns the deallocated size, 0 if ptr does not belong to any arena */
+	size_t Deallocate(void* ptr);
+	/** Not thread-safe, no other thread must be using the arenas */
+	void Reset();
+	/** Thread-safe. Bytes usable from ptr, 0 if ptr does not belong to any arena */
+	size_t GetUsableSize(const void* ptr) const;
+	inline bool Contains(const void* ptr) const { return FindArena(ptr) < m_arenasCount; }
+
+	inline size_t GetArenasCount() const { return m_arenasCount; }
+	inline size_t GetTotalAllocatedMemory() const { return m_arenasCount * m_arenaSize; }
+	/** Thread-safe. Footprint of every arena pool, arena descriptors included */
+	MemoryFootprint GetMemoryFootprint();
+	inline PageAllocator::Backing GetPageBacking() const { return mp_arenas[0].allocator.GetPageBacking(); }
+
+private:
+	/** Arenas are kept on separate cache lines, so locking one never invalidates its neighbours */
+	struct alignas(64) Arena
+	{
+		Arena(size_t PoolSize, FreeListAllocator::FitPolicy Policy, bool HugePages)
+			: allocator(PoolSize, Policy, HugePages) {}
+
+		std::mutex lock;
+		FreeListAllocator allocator;
+	};
+
+	size_t SelectArena() const;
+	/** Index of the arena whose pool contains ptr, m_arenasCount if none */
+	size_t FindArena(const void* ptr) const;
+
+	const size_t m_arenasCount;
+	const size_t m_arenaSize;
+	const ArenaSelection m_selection;
+	/** Raw memory hosting the arenas, over-allocated to align them to a cache line */
+	void* mp_storage = nullptr;
+	Arena* mp_arenas = nullptr;
+};
@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "LatencyHistogram.h"
+#include <cmath>
+
+void LatencyHistogram::Reset()
+{
+	std::memset(m_counts, 0, sizeof(m_counts));
+	m_count = 0;
+	m_max = 0;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double Percentile) const
+{
+	if (m_count == 0) return 0;
+
+	const double clamped = Percentile < 0.0 ? 0.0 : (Percentile > 100.0 ? 100.0 : Percentile);
+	uint64_t target = static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(m_count)));
+	if (target == 0) target = 1;
+
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+	{
+		seen += m_counts[bucket];
+		if (seen >= target)
+		{
+			//a bucket bound may exceed every recorded value, the max is exact
+			const uint64_t bound = GetBucketUpperBound(bucket);
+			return bound < m_max ? bound : m_max;
+		}
+	}
+	return m_max;
+}
+
+double LatencyHistogram::GetTicksPerNanosecond()
+{
+	static const double ticksPerNanosecond = []() {
+		//spin for a short while and compare the two clocks
+		const auto start = std::chrono::steady_clock::now();
+		const uint64_t startTicks = ReadTicks();
+		auto now = start;
+		while (now - start < std::chrono::milliseconds(10))
+		{
+			now = std::chrono::steady_clock::now();
+		}
+		const uint64_t elapsedTicks = ReadTicks() - startTicks;
+		const double elapsedNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+		return elapsedTicks > 0 ? static_cast<double>(elapsedTicks) / elapsedNs : 1.0;
+	}();
+	return ticksPerNanosecond;
+}
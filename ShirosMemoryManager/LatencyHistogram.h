@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include "BitOps.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using std::size_t;
+
+/**
+ * HDR style latency histogram: every power of two is split in SUB_BUCKETS linear buckets,
+ * so any value is recorded with a relative error below 1 / SUB_BUCKETS and a record is a couple of shifts and an increment.
+ * Values are raw cycle counter ticks, converted to nanoseconds only when reporting. Not thread-safe
+ */
+class LatencyHistogram
+{
+public:
+	static constexpr unsigned SUB_BUCKET_BITS = 4;
+	static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+	/** Magnitude 0 holds the values below SUB_BUCKETS, magnitude m the values with the most significant bit at SUB_BUCKET_BITS + m - 1 */
+	static constexpr size_t MAGNITUDES = 64 - SUB_BUCKET_BITS + 1;
+	static constexpr size_t BUCKETS = MAGNITUDES * SUB_BUCKETS;
+
+	LatencyHistogram() { Reset(); }
+
+	inline void Record(uint64_t ticks)
+	{
+		++m_counts[GetBucket(ticks)];
+		++m_count;
+		if (ticks > m_max) m_max = ticks;
+	}
+
+	void Reset();
+	/** Smallest recorded value bound such that Percentile% of the records are not above it. 0 when empty */
+	uint64_t GetPercentile(double Percentile) const;
+	inline uint64_t GetMax() const { return m_max; }
+	inline uint64_t GetCount() const { return m_count; }
+
+	/** Cheapest monotonic tick source of the platform: TSC on x86, virtual counter on ARM64, steady_clock nanoseconds elsewhere */
+	static inline uint64_t ReadTicks()
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		uint64_t ticks;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+		return ticks;
+#else
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+	/** Tick rate measured against steady_clock on first use */
+	static double GetTicksPerNanosecond();
+	static inline double ToNanoseconds(uint64_t ticks) { return static_cast<double>(ticks) / GetTicksPerNanosecond(); }
+
+private:
+	static inline size_t GetBucket(uint64_t ticks)
+	{
+		if (ticks < SUB_BUCKETS) return static_cast<size_t>(ticks);
+
+		//keep the SUB_BUCKET_BITS bits following the most significant one
+		const unsigned shift = FloorLog2(ticks) - SUB_BUCKET_BITS;
+		return (shift + 1) * SUB_BUCKETS + static_cast<size_t>((ticks >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	/** Largest value falling in a bucket */
+	static inline uint64_t GetBucketUpperBound(size_t bucket)
+	{
+		const size_t magnitude = bucket / SUB_BUCKETS;
+		const uint64_t sub = bucket % SUB_BUCKETS;
+		if (magnitude == 0) return sub;
+
+		const unsigned shift = static_cast<unsigned>(magnitude - 1);
+		return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+	}
+
+	uint64_t m_counts[BUCKETS];
+	uint64_t m_count;
+	uint64_t m_max;
+};
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "LockFreeFixedAllocator.h"
+#include <cstdlib>
+#include <new>
+
+LockFreeFixedAllocator::LockFreeFixedAllocator(size_t BlockSize)
+	: m_blockSize(BlockSize),
+	m_head(Pack(NO_BLOCK, 0)),
+	m_slabsCount(0)
+{
+	assert(BlockSize > 0); //ensure you're not creating an allocator of size 0, min. 1
+	assert(m_head.is_lock_free() && "64 bit CAS is required");
+
+	for (size_t i = 0; i < MAX_SLABS; ++i)
+	{
+		m_slabs[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+LockFreeFixedAllocator::~LockFreeFixedAllocator()
+{
+	const size_t slabsCount = m_slabsCount.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < slabsCount; ++i)
+	{
+		unsigned char* data = m_slabs[i].load(std::memory_order_relaxed);
+		std::atomic<uint32_t>* links = GetLinks(i, data);
+		for (size_t j = 0; j < GetSlabBlocks(i); ++j)
+		{
+			links[j].~atomic();
+		}
+		std::free(data);
+	}
+}
+
+uint32_t LockFreeFixedAllocator::GetBlockIndex(const void* ptr) const
+{
+	//slabs are few and the largest ones come last, scan them from the end
+	const unsigned char* p = static_cast<const unsigned char*>(ptr);
+	for (size_t slab = m_slabsCount.load(std::memory_order_acquire); slab-- > 0;)
+	{
+		const unsigned char* data = m_slabs[slab].load(std::memory_order_acquire);
+		if (p >= data && p < data + GetSlabBlocks(slab) * m_blockSize)
+		{
+			assert((p - data) % m_blockSize == 0); //alignment check to block size
+			return static_cast<uint32_t>(GetSlabStart(slab) + (p - data) / m_blockSize);
+		}
+	}
+
+	assert(false && "Block not allocated by this LockFreeFixedAllocator");
+	return NO_BLOCK;
+}
+
+void LockFreeFixedAllocator::Grow()
+{
+	std::lock_guard<std::mutex> guard(m_growLock);
+
+	//another thread may have grown or released blocks while we were waiting
+	if (GetIndex(m_head.load(std::memory_order_acquire)) != NO_BLOCK) return;
+
+	const size_t slab = m_slabsCount.load(std::memory_order_relaxed);
+	assert(slab < MAX_SLABS && "LockFreeFixedAllocator exhausted its index space");
+	if (slab >= MAX_SLABS) { throw std::bad_alloc(); }
+
+	const size_t blocks = GetSlabBlocks(slab);
+	unsigned char* data = static_cast<unsigned char*>(std::malloc(GetLinksOffset(slab) + blocks * sizeof(std::atomic<uint32_t>)));
+	if (!data) { throw std::bad_alloc(); }
+
+	//chain the new blocks in address order, the last one will point to the current top
+	const uint32_t first = static_cast<uint32_t>(GetSlabStart(slab));
+	const uint32_t last = static_cast<uint32_t>(first + blocks - 1);
+	std::atomic<uint32_t>* links = GetLinks(slab, data);
+	for (size_t j = 0; j < blocks; ++j)
+	{
+		new(&links[j]) std::atomic<uint32_t>(static_cast<uint32_t>(first + j + 1));
+	}
+
+	//publish the slab before any of its indices can be seen on the stack
+	m_slabs[slab].store(data, std::memory_order_release);
+	m_slabsCount.store(slab + 1, std::memory_order_release);
+
+	uint64_t head = m_head.load(std::memory_order_relaxed);
+	do
+	{
+		links[last - first].store(GetIndex(head), std::memory_order_relaxed);
+	} while (!m_head.compare_exchange_weak(head, Pack(first, GetTag(head) + 1), std::memory_order_release, std::memory_order_relaxed));
+}
+
+size_t LockFreeFixedAllocator::GetTotalAllocatedMemory() const
+{
+	size_t totMemoryAllocated = 0;
+	const size_t slabsCount = m_slabsCount.load(std::memory_order_acquire);
+	for (size_t i = 0; i < slabsCount; ++i)
+	{
+		totMemoryAllocated += GetLinksOffset(i) + GetSlabBlocks(i) * sizeof(std::atomic<uint32_t>);
+	}
+	return totMemoryAllocated;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cassert>
+#include "BitOps.h"
+
+/**
+ * Thread-safe FixedAllocator variant for size classes shared among threads.
+ * Free blocks form a Treiber stack whose head packs the index of the top block with a version tag,
+ * so an allocation or a deallocation is a single CAS and the ABA problem cannot corrupt the stack.
+ * Blocks are addressed by index: slabs grow geometrically and are never released before destruction,
+ * links live in a side table next to each slab, so free blocks memory is never touched by the allocator
+ */
+class LockFreeFixedAllocator
+{
+public:
+	static constexpr size_t FIRST_SLAB_BLOCKS = 64;
+	/** Slab k hosts FIRST_SLAB_BLOCKS << k blocks, indices must fit 32 bits */
+	static constexpr size_t MAX_SLABS = 26;
+
+	explicit LockFreeFixedAllocator(size_t BlockSize);
+	~LockFreeFixedAllocator();
+
+	/** Prevent copy for this class */
+	LockFreeFixedAllocator(const LockFreeFixedAllocator&) = delete;
+	LockFreeFixedAllocator& operator=(const LockFreeFixedAllocator&) = delete;
+
+	/** Thread-safe. Pops the top of the free stack, a new slab is added under a lock only when the stack is empty */
+	inline void* Allocate()
+	{
+		uint64_t head = m_head.load(std::memory_order_acquire);
+		for (;;)
+		{
+			const uint32_t index = GetIndex(head);
+			if (index == NO_BLOCK)
+			{
+				Grow();
+				head = m_head.load(std::memory_order_acquire);
+				continue;
+			}
+
+			//next may be stale if another thread popped index meanwhile, the tag makes the CAS fail in that case
+			const uint32_t next = GetNextLink(index).load(std::memory_order_relaxed);
+			if (m_head.compare_exchange_weak(head, Pack(next, GetTag(head) + 1), std::memory_order_acquire, std::memory_order_acquire))
+			{
+				return GetBlock(index);
+			}
+		}
+	}
+
+	/** Thread-safe. Pushes the block back on the free stack */
+	inline void Deallocate(void* ptr)
+	{
+		assert(ptr);
+		const uint32_t index = GetBlockIndex(ptr);
+
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+		do
+		{
+			GetNextLink(index).store(GetIndex(head), std::memory_order_relaxed);
+		} while (!m_head.compare_exchange_weak(head, Pack(index, GetTag(head) + 1), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	inline size_t GetBlockSize() const { return m_blockSize; }
+	/** Memory reserved by all the slabs, metadata included */
+	size_t GetTotalAllocatedMemory() const;
+
+private:
+	static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+	/** Head layout: low 32 bits block index, high 32 bits version tag */
+	static inline uint64_t Pack(uint32_t index, uint32_t tag) { return (static_cast<uint64_t>(tag) << 32) | index; }
+	static inline uint32_t GetIndex(uint64_t head) { return static_cast<uint32_t>(head); }
+	static inline uint32_t GetTag(uint64_t head) { return static_cast<uint32_t>(head >> 32); }
+
+	/** Slab k starts at block FIRST_SLAB_BLOCKS * (2^k - 1) */
+	static inline size_t GetSlab(uint32_t index) { return FloorLog2(index / FIRST_SLAB_BLOCKS + 1); }
+	static inline size_t GetSlabStart(size_t slab) { return FIRST_SLAB_BLOCKS * ((size_t(1) << slab) - 1); }
+	static inline size_t GetSlabBlocks(size_t slab) { return FIRST_SLAB_BLOCKS << slab; }
+
+	inline unsigned char* GetBlock(uint32_t index) const
+	{
+		const size_t slab = GetSlab(index);
+		return m_slabs[slab].load(std::memory_order_acquire) + (index - GetSlabStart(slab)) * m_blockSize;
+	}
+
+	/** Links are stored right after the blocks of each slab */
+	inline std::atomic<uint32_t>& GetNextLink(uint32_t index) const
+	{
+		const size_t slab = GetSlab(index);
+		return GetLinks(slab, m_slabs[slab].load(std::memory_order_acquire))[index - GetSlabStart(slab)];
+	}
+
+	inline std::atomic<uint32_t>* GetLinks(size_t slab, unsigned char* data) const
+	{
+		return reinterpret_cast<std::atomic<uint32_t>*>(data + GetLinksOffset(slab));
+	}
+
+	inline size_t GetLinksOffset(size_t slab) const
+	{
+		const size_t blocksBytes = GetSlabBlocks(slab) * m_blockSize;
+		return (blocksBytes + alignof(std::atomic<uint32_t>) - 1) & ~(alignof(std::atomic<uint32_t>) - 1);
+	}
+
+	/** Index of the block containing ptr, searching the slab whose range contains it */
+	uint32_t GetBlockIndex(const void* ptr) const;
+	/** Add a new slab and push all its blocks on the free stack. Serialized, other threads keep allocating meanwhile */
+	void Grow();
+
+	const size_t m_blockSize;
+	/** Top of the free stack, tagged */
+	std::atomic<uint64_t> m_head;
+	std::atomic<unsigned char*> m_slabs[MAX_SLABS];
+	std::atomic<size_t> m_slabsCount;
+	std::mutex m_growLock;
+};
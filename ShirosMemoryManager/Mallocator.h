@@ -29,7 +29,7 @@ public:
 	inline const_pointer address(const_reference ref) const { return &ref; }
 	inline size_type max_size() const throw() { return std::numeric_limits<size_t>::max() / sizeof(value_type); }
 
-	inline pointer allocate(size_type n, std::allocator<void>::const_pointer hint = 0)
+	inline pointer allocate(size_type n, const void* hint = 0)
 	{
 		if (n == 0) { return nullptr; }
 		if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
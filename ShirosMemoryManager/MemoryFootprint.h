@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+
+using std::size_t;
+
+/** Where the memory an allocator took from the system goes, in bytes. The four parts add up to the whole reservation */
+struct MemoryFootprint
+{
+	/** Blocks handed out, at their block size: rounding of a request up to its block is counted here */
+	size_t allocatedBytes = 0;
+	/** Reserved for blocks, currently free */
+	size_t freeBytes = 0;
+	/** Bookkeeping: allocator objects, chunk descriptors, block headers, map nodes */
+	size_t metadataBytes = 0;
+	/** Reserved bytes no block can use: chunk tails, alignment padding, mappings rounded up to the page size */
+	size_t wastedBytes = 0;
+
+	inline size_t GetReservedBytes() const { return allocatedBytes + freeBytes + metadataBytes + wastedBytes; }
+
+	inline MemoryFootprint& operator+=(const MemoryFootprint& other)
+	{
+		allocatedBytes += other.allocatedBytes;
+		freeBytes += other.freeBytes;
+		metadataBytes += other.metadataBytes;
+		wastedBytes += other.wastedBytes;
+		return *this;
+	}
+};
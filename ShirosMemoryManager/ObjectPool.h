@@ -0,0 +1,183 @@
+#pragma once
+#include <new>
+#include <utility>
+#include <cstddef>
+#include "FixedAllocator.h"
+
+/**
+ * Pool of objects of type T, stored in the chunks of a dedicated FixedAllocator.
+ * Objects are constructed and destroyed in place and released without any size argument.
+ * When KeepWarm is enabled, released objects are not destroyed: they are kept constructed
+ * so that Reuse can hand them back for a cheap reinitialisation.
+ * Live objects can be visited chunk by chunk, in address order, for cache friendly batch processing.
+ * Chunks track free blocks with a bitmap, so finding live objects reads only chunk metadata
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+	explicit ObjectPool(bool KeepWarm = false, size_t ChunkSize = DEFAULT_CHUNK_SIZE)
+		: m_allocator(ChunkSize, sizeof(Slot), FixedAllocator::FreeTracking::BITMAP),
+		m_keepWarm(KeepWarm)
+	{
+		static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types are not supported by FixedAllocator chunks");
+	}
+
+	~ObjectPool()
+	{
+		Clear();
+	}
+
+	/** Prevent copy for this class */
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	/** Construct a new object in place. A warm object, if any, is destroyed and its slot reused */
+	template <typename... Args>
+	T* Create(Args&&... args)
+	{
+		Slot* slot = PopWarm();
+		if (slot)
+		{
+			slot->Get()->~T();
+		}
+		else
+		{
+			slot = static_cast<Slot*>(m_allocator.Allocate());
+		}
+		return Construct(slot, std::forward<Args>(args)...);
+	}
+
+	/** Hand back a warm object as it was left when released, the caller is in charge of reinitialising it. Falls back to a default constructed object */
+	T* Reuse()
+	{
+		Slot* slot = PopWarm();
+		if (slot)
+		{
+			slot->m_live = true;
+			++m_liveCount;
+			return slot->Get();
+		}
+		return Construct(static_cast<Slot*>(m_allocator.Allocate()));
+	}
+
+	/** Construct Count objects copying args, pulling whole runs of blocks out of the chunks. Returns the number of constructed objects */
+	template <typename... Args>
+	size_t CreateBatch(T** OutObjects, size_t Count, const Args&... args)
+	{
+		size_t created = 0;
+		//warm slots first
+		for (; created < Count && mp_warmList; ++created)
+		{
+			OutObjects[created] = Create(args...);
+		}
+
+		//then whole runs of fresh blocks
+		void* blocks[UCHAR_MAX];
+		while (created < Count)
+		{
+			const size_t toAllocate = (Count - created) < UCHAR_MAX ? (Count - created) : UCHAR_MAX;
+			const size_t allocated = m_allocator.AllocateBatch(blocks, toAllocate);
+			for (size_t i = 0; i < allocated; ++i)
+			{
+				OutObjects[created + i] = Construct(static_cast<Slot*>(blocks[i]), args...);
+			}
+			created += allocated;
+		}
+		return created;
+	}
+
+	/** Release an object previously obtained from this pool. No size is needed */
+	void Destroy(T* obj)
+	{
+		if (!obj) return;
+
+		Slot* slot = Slot::From(obj);
+		assert(slot->m_live && "Object released twice or not owned by this pool");
+		slot->m_live = false;
+		--m_liveCount;
+
+		if (m_keepWarm)
+		{
+			//keep the object constructed, only link it in the warm list
+			slot->mp_nextWarm = mp_warmList;
+			mp_warmList = slot;
+			++m_warmCount;
+			return;
+		}
+
+		obj->~T();
+		m_allocator.Deallocate(slot);
+	}
+
+	/** Invoke func(T&) on every live object. func must not create or destroy objects of this pool */
+	template <typename Func>
+	void ForEach(Func&& func)
+	{
+		m_allocator.ForEachAllocatedBlock([&func](void* block) {
+			Slot* slot = static_cast<Slot*>(block);
+			if (slot->m_live)
+			{
+				func(*slot->Get());
+			}
+		});
+	}
+
+	/** Destroy every object, live and warm, and give back all the chunks */
+	void Clear()
+	{
+		m_allocator.ForEachAllocatedBlock([](void* block) {
+			static_cast<Slot*>(block)->Get()->~T(); //warm objects are still constructed too
+		});
+		m_allocator.Release();
+
+		mp_warmList = nullptr;
+		m_liveCount = 0;
+		m_warmCount = 0;
+	}
+
+	inline size_t GetLiveCount() const { return m_liveCount; }
+	inline size_t GetWarmCount() const { return m_warmCount; }
+	inline size_t GetTotalAllocatedMemory() const { return m_allocator.GetTotalAllocatedMemory(); }
+
+private:
+	/** Block layout: object storage first, so a T* is also the address of its slot */
+	struct Slot
+	{
+		alignas(T) unsigned char m_storage[sizeof(T)];
+		Slot* mp_nextWarm;
+		bool m_live;
+
+		inline T* Get() { return reinterpret_cast<T*>(m_storage); }
+		static inline Slot* From(T* obj) { return reinterpret_cast<Slot*>(obj); }
+	};
+
+	inline Slot* PopWarm()
+	{
+		Slot* slot = mp_warmList;
+		if (slot)
+		{
+			mp_warmList = slot->mp_nextWarm;
+			--m_warmCount;
+		}
+		return slot;
+	}
+
+	template <typename... Args>
+	inline T* Construct(Slot* slot, Args&&... args)
+	{
+		assert(slot);
+		T* obj = new(static_cast<void*>(slot->m_storage)) T(std::forward<Args>(args)...);
+		slot->mp_nextWarm = nullptr;
+		slot->m_live = true;
+		++m_liveCount;
+		return obj;
+	}
+
+	FixedAllocator m_allocator;
+	/** Released objects kept constructed, linked through their slot */
+	Slot* mp_warmList = nullptr;
+	const bool m_keepWarm;
+	size_t m_liveCount = 0;
+	size_t m_warmCount = 0;
+};
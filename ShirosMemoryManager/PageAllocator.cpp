@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "PageAllocator.h"
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <cstdio>
+#endif
+
+namespace {
+	constexpr size_t DEFAULT_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	inline size_t RoundUp(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) & ~(alignment - 1);
+	}
+
+#ifdef _WIN32
+	/** Large pages require the SeLockMemoryPrivilege to be held and enabled for the process */
+	bool EnableLockMemoryPrivilege()
+	{
+		HANDLE token;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		bool enabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+			&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+			&& GetLastError() == ERROR_SUCCESS; //AdjustTokenPrivileges succeeds even if the privilege is not held
+		CloseHandle(token);
+		return enabled;
+	}
+#endif
+}
+
+size_t PageAllocator::GetHugePageSize()
+{
+	static const size_t hugePageSize = []() -> size_t
+	{
+#ifdef _WIN32
+		const size_t largePageMinimum = GetLargePageMinimum();
+		return largePageMinimum > 0 ? largePageMinimum : DEFAULT_HUGE_PAGE_SIZE;
+#elif defined(__linux__)
+		size_t kiloBytes = 0;
+		if (FILE* meminfo = std::fopen("/proc/meminfo", "r"))
+		{
+			char line[128];
+			while (std::fgets(line, sizeof(line), meminfo))
+			{
+				if (std::sscanf(line, "Hugepagesize: %zu kB", &kiloBytes) == 1) break;
+			}
+			std::fclose(meminfo);
+		}
+		return kiloBytes > 0 ? kiloBytes * 1024 : DEFAULT_HUGE_PAGE_SIZE;
+#else
+		return DEFAULT_HUGE_PAGE_SIZE;
+#endif
+	}();
+	return hugePageSize;
+}
+
+PageAllocator::Mapping PageAllocator::Map(size_t Size, bool HugePages)
+{
+	Mapping mapping;
+	if (Size == 0) return mapping;
+
+#ifdef _WIN32
+	if (HugePages)
+	{
+		static const bool canUseLargePages = EnableLockMemoryPrivilege();
+		const size_t largeSize = RoundUp(Size, GetHugePageSize());
+		void* p = canUseLargePages ? VirtualAlloc(nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE) : nullptr;
+		if (p)
+		{
+			mapping.ptr = p;
+			mapping.size = largeSize;
+			mapping.backing = Backing::HUGE_PAGES;
+			return mapping;
+		}
+		//no privilege or not enough contiguous physical memory, Windows has no transparent huge pages
+	}
+	mapping.ptr = VirtualAlloc(nullptr, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	mapping.size = mapping.ptr ? Size : 0;
+#elif defined(__linux__)
+	if (HugePages)
+	{
+		const size_t hugePageSize = GetHugePageSize();
+		const size_t hugeSize = RoundUp(Size, hugePageSize);
+
+#ifdef MAP_HUGETLB
+		void* p = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			mapping.ptr = p;
+			mapping.size = hugeSize;
+			mapping.backing = Backing::HUGE_PAGES;
+			return mapping;
+		}
+#endif
+		//hugetlbfs pool is empty: over-map, keep the huge page aligned part and let khugepaged back it
+		const size_t overSize = hugeSize + hugePageSize;
+		unsigned char* raw = static_cast<unsigned char*>(mmap(nullptr, overSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (raw != MAP_FAILED)
+		{
+			unsigned char* aligned = reinterpret_cast<unsigned char*>(RoundUp(reinterpret_cast<size_t>(raw), hugePageSize));
+			const size_t head = aligned - raw;
+			const size_t tail = overSize - head - hugeSize;
+			if (head > 0) munmap(raw, head);
+			if (tail > 0) munmap(aligned + hugeSize, tail);
+
+			mapping.ptr = aligned;
+			mapping.size = hugeSize;
+#ifdef MADV_HUGEPAGE
+			mapping.backing = madvise(aligned, hugeSize, MADV_HUGEPAGE) == 0 ? Backing::TRANSPARENT_HUGE_PAGES : Backing::DEFAULT_PAGES;
+#endif
+			return mapping;
+		}
+	}
+	void* p = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED)
+	{
+		mapping.ptr = p;
+		mapping.size = Size;
+	}
+#else
+	mapping.ptr = std::malloc(Size);
+	mapping.size = mapping.ptr ? Size : 0;
+#endif
+
+	return mapping;
+}
+
+void PageAllocator::Unmap(const Mapping& mapping)
+{
+	if (!mapping.ptr) return;
+
+#ifdef _WIN32
+	VirtualFree(mapping.ptr, 0, MEM_RELEASE);
+#elif defined(__linux__)
+	munmap(mapping.ptr, mapping.size);
+#else
+	std::free(mapping.ptr);
+#endif
+}
+
+const char* PageAllocator::ToString(Backing backing)
+{
+	switch (backing)
+	{
+	case Backing::HUGE_PAGES: return "huge pages";
+	case Backing::TRANSPARENT_HUGE_PAGES: return "transparent huge pages";
+	default: return "default pages";
+	}
+}
+
+ChunkSlabProvider::ChunkSlabProvider(size_t PieceSize, bool HugePages /* = true */)
+	: m_pieceSize(RoundUp(PieceSize, alignof(std::max_align_t))),
+	m_hugePages(HugePages)
+{
+	assert(PieceSize > 0);
+}
+
+ChunkSlabProvider::~ChunkSlabProvider()
+{
+	while (mp_slabs)
+	{
+		//the header lives inside the mapping, read what we need before unmapping it
+		SlabHeader* next = mp_slabs->next;
+		const PageAllocator::Mapping mapping = mp_slabs->mapping;
+		PageAllocator::Unmap(mapping);
+		mp_slabs = next;
+	}
+}
+
+void* ChunkSlabProvider::Allocate()
+{
+	if (!mp_freePieces && !MapSlab()) return nullptr;
+
+	void* piece = mp_freePieces;
+	std::memcpy(&mp_freePieces, piece, sizeof(void*));
+	--m_freePiecesCount;
+	return piece;
+}
+
+void ChunkSlabProvider::Deallocate(void* piece)
+{
+	assert(piece);
+	std::memcpy(piece, &mp_freePieces, sizeof(void*));
+	mp_freePieces = piece;
+	++m_freePiecesCount;
+}
+
+bool ChunkSlabProvider::MapSlab()
+{
+	const size_t headerSize = RoundUp(sizeof(SlabHeader), alignof(std::max_align_t));
+	//a slab is at least a huge page, and always hosts a reasonable number of pieces
+	size_t slabSize = PageAllocator::GetHugePageSize();
+	while (slabSize < headerSize + 16 * m_pieceSize)
+	{
+		slabSize *= 2;
+	}
+
+	const PageAllocator::Mapping mapping = PageAllocator::Map(slabSize, m_hugePages);
+	if (!mapping.ptr) return false;
+
+	SlabHeader* slab = static_cast<SlabHeader*>(mapping.ptr);
+	slab->mapping = mapping;
+	slab->next = mp_slabs;
+	mp_slabs = slab;
+	++m_slabsCount;
+	m_mappedBytes += mapping.size;
+	m_backing = mapping.backing;
+
+	//carve the slab, pushing pieces backwards so they are handed out in address order
+	unsigned char* first = static_cast<unsigned char*>(mapping.ptr) + headerSize;
+	const size_t piecesCount = (mapping.size - headerSize) / m_pieceSize;
+	for (size_t i = piecesCount; i > 0; --i)
+	{
+		Deallocate(first + (i - 1) * m_pieceSize);
+	}
+	m_piecesCount += piecesCount;
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstddef>
+
+using std::size_t;
+
+/**
+ * Maps memory straight from the operating system, optionally backed by huge pages.
+ * Huge pages are requested explicitly first (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows).
+ * When the system has none reserved, Linux falls back to a huge page aligned mapping advised for transparent huge pages,
+ * every other platform falls back to regular pages
+ */
+class PageAllocator
+{
+public:
+	/** How a mapping is effectively backed */
+	enum class Backing
+	{
+		/** Regular pages */
+		DEFAULT_PAGES,
+		/** Explicit huge pages, reserved by the system for this mapping */
+		HUGE_PAGES,
+		/** Regular mapping the kernel is advised to promote to transparent huge pages */
+		TRANSPARENT_HUGE_PAGES
+	};
+
+	/** A mapped range. Keep it to release the memory */
+	struct Mapping
+	{
+		void* ptr = nullptr;
+		size_t size = 0;
+		Backing backing = Backing::DEFAULT_PAGES;
+	};
+
+	/** Map at least Size bytes. With HugePages the size is rounded up to the huge page size. Returns an empty Mapping on failure */
+	static Mapping Map(size_t Size, bool HugePages);
+	static void Unmap(const Mapping& mapping);
+
+	/** Huge page size of the system, 2MB when it cannot be queried */
+	static size_t GetHugePageSize();
+	static const char* ToString(Backing backing);
+};
+
+/**
+ * Hands out fixed size pieces carved from huge page backed slabs, to keep many small chunks in few TLB entries.
+ * Released pieces are recycled, slabs are given back only on destruction. Not thread-safe: it is used by the owner only
+ */
+class ChunkSlabProvider
+{
+public:
+	explicit ChunkSlabProvider(size_t PieceSize, bool HugePages = true);
+	~ChunkSlabProvider();
+
+	/** Prevent copy for this class */
+	ChunkSlabProvider(const ChunkSlabProvider&) = delete;
+	ChunkSlabProvider& operator=(const ChunkSlabProvider&) = delete;
+
+	/** Pieces larger than GetPieceSize are not served, callers fall back to malloc. Returns nullptr if no slab can be mapped */
+	void* Allocate();
+	void Deallocate(void* piece);
+
+	inline size_t GetPieceSize() const { return m_pieceSize; }
+	inline size_t GetSlabsCount() const { return m_slabsCount; }
+	/** Bytes mapped by all the slabs, headers included */
+	inline size_t GetMappedBytes() const { return m_mappedBytes; }
+	/** Pieces carved from the slabs, either handed out or free */
+	inline size_t GetPiecesCount() const { return m_piecesCount; }
+	inline size_t GetFreePiecesCount() const { return m_freePiecesCount; }
+	/** Backing of the last slab mapped */
+	inline PageAllocator::Backing GetBacking() const { return m_backing; }
+
+private:
+	/** Placed at the start of every slab, slabs are linked to be unmapped on destruction */
+	struct SlabHeader
+	{
+		PageAllocator::Mapping mapping;
+		SlabHeader* next;
+	};
+
+	bool MapSlab();
+
+	const size_t m_pieceSize;
+	const bool m_hugePages;
+	SlabHeader* mp_slabs = nullptr;
+	/** Released pieces, each one stores the address of the next one */
+	void* mp_freePieces = nullptr;
+	size_t m_slabsCount = 0;
+	size_t m_mappedBytes = 0;
+	size_t m_piecesCount = 0;
+	size_t m_freePiecesCount = 0;
+	PageAllocator::Backing m_backing = PageAllocator::Backing::DEFAULT_PAGES;
+};
@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "PersistentHeap.h"
+#include <cstdio>
+
+PersistentHeap::PersistentHeap(const char* Path, size_t Size, bool RecreateIfDirty /* = false */)
+{
+	switch (Open(Path, Backing::FILE))
+	{
+	case OpenResult::OPENED:
+		//the flag stays cleared until this run closes the heap
+		if (GetHeader()->clean.exchange(0, std::memory_order_acq_rel) == 1)
+		{
+			m_restored = true;
+		}
+		else if (!RecreateIfDirty)
+		{
+			cout << "Persistent heap " << Path << " was not closed cleanly, leaving it untouched" << endl;
+			UnmapSegment();
+		}
+		else
+		{
+			//the file is still locked by this process, it is formatted in place
+			cout << "Persistent heap " << Path << " was not closed cleanly, formatting it again" << endl;
+			if (!Format(Size))
+			{
+				cout << "Persistent heap " << Path << " could not be formatted" << endl;
+			}
+		}
+		break;
+	case OpenResult::NOT_FOUND:
+		if (!Create(Path, Size, Backing::FILE))
+		{
+			cout << "Persistent heap " << Path << " could not be created" << endl;
+		}
+		break;
+	case OpenResult::IN_USE:
+		cout << "Persistent heap " << Path << " is in use by another process" << endl;
+		break;
+	default:
+		cout << "Persistent heap " << Path << " could not be opened or does not hold a heap of this layout" << endl;
+		break;
+	}
+}
+
+PersistentHeap::~PersistentHeap()
+{
+	if (!IsValid()) return;
+
+	//content must reach the file before the flag declaring it consistent
+	FlushSegment();
+	GetHeader()->clean.store(1, std::memory_order_release);
+	FlushSegment();
+}
+
+void PersistentHeap::Flush()
+{
+	FlushSegment();
+}
+
+void PersistentHeap::Remove(const char* Path)
+{
+	std::remove(Path);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "SharedMemoryHeap.h"
+
+/**
+ * SharedMemoryHeap kept in a regular file, for warm restarts: a process maps the heap left by its previous run
+ * and finds its data structures through the root table instead of rebuilding them.
+ * Free list links are offsets, so the file can be mapped at any base address. Structures stored in it must follow the same rule,
+ * linking their nodes by offset and translating them with FromOffset.
+ * A heap is restored only if the previous run closed it cleanly, a crash could have left its free list half updated.
+ * Only one process at a time can use the file: it stays locked while mapped (flock, a handle opened without sharing on Windows),
+ * and the lock dies with the process holding it.
+ * A file that does not hold a heap of this layout is never modified nor deleted
+ */
+class PersistentHeap : public SharedMemoryHeap
+{
+public:
+	/** 
+	 * Reopen the heap stored at Path, or create a new one of Size bytes when there is none.
+	 * A heap not closed cleanly is formatted again, to Size bytes, only with RecreateIfDirty.
+	 * The heap is left invalid when Path is not a heap, is locked by another process or could not be restored
+	 */
+	PersistentHeap(const char* Path, size_t Size, bool RecreateIfDirty = false);
+	/** Flush the heap and mark it as cleanly closed */
+	~PersistentHeap();
+
+	/** Whether the heap content comes from a previous run */
+	inline bool WasRestored() const { return m_restored; }
+	/** Write the heap back to its file. The heap stays open */
+	void Flush();
+
+	/** Delete the heap file. It must not be in use */
+	static void Remove(const char* Path);
+
+private:
+	bool m_restored = false;
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
+#include <new>
+#include <utility>
+#include "BitOps.h"
+
+/**
+ * Vector whose elements never move. Storage is a list of segments of geometrically growing size:
+ * segment k holds FIRST_SEGMENT_SIZE << k elements, so adding an element never copies the previous ones,
+ * pointers to elements stay valid until they are popped and indexed access is O(1).
+ * Memory comes straight from malloc, like Mallocator does, so it can be used inside the Memory Manager.
+ */
+template <typename T>
+class SegmentedVector
+{
+public:
+	static constexpr size_t FIRST_SEGMENT_SIZE = 8;
+	static constexpr size_t MAX_SEGMENTS = 32;
+
+	SegmentedVector() = default;
+
+	SegmentedVector(const SegmentedVector& other)
+	{
+		for (size_t i = 0; i < other.m_size; ++i)
+		{
+			push_back(other[i]);
+		}
+	}
+
+	SegmentedVector& operator=(const SegmentedVector& other)
+	{
+		SegmentedVector copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	~SegmentedVector()
+	{
+		clear();
+		for (size_t k = 0; k < MAX_SEGMENTS && m_segments[k]; ++k)
+		{
+			std::free(m_segments[k]);
+			m_segments[k] = nullptr;
+		}
+	}
+
+	void swap(SegmentedVector& other)
+	{
+		for (size_t k = 0; k < MAX_SEGMENTS; ++k)
+		{
+			std::swap(m_segments[k], other.m_segments[k]);
+		}
+		std::swap(m_size, other.m_size);
+	}
+
+	inline T& operator[](size_t index)
+	{
+		assert(index < m_size);
+		const size_t segment = GetSegment(index);
+		return m_segments[segment][index - GetSegmentStart(segment)];
+	}
+
+	inline const T& operator[](size_t index) const
+	{
+		assert(index < m_size);
+		const size_t segment = GetSegment(index);
+		return m_segments[segment][index - GetSegmentStart(segment)];
+	}
+
+	inline T& front() { return (*this)[0]; }
+	inline T& back() { return (*this)[m_size - 1]; }
+	inline size_t size() const { return m_size; }
+	inline bool empty() const { return m_size == 0; }
+	/** Elements the allocated segments can hold */
+	inline size_t capacity() const
+	{
+		size_t elements = 0;
+		for (size_t segment = 0; segment < MAX_SEGMENTS && m_segments[segment]; ++segment)
+		{
+			elements += GetSegmentSize(segment);
+		}
+		return elements;
+	}
+
+	/** Amortized O(1): a new segment is allocated only when the last one is full, no element is ever copied */
+	void push_back(const T& value)
+	{
+		const size_t segment = GetSegment(m_size);
+		assert(segment < MAX_SEGMENTS);
+		if (!m_segments[segment])
+		{
+			m_segments[segment] = static_cast<T*>(std::malloc(GetSegmentSize(segment) * sizeof(T)));
+			if (!m_segments[segment]) { throw std::bad_alloc(); }
+		}
+		new(&m_segments[segment][m_size - GetSegmentStart(segment)]) T(value);
+		++m_size;
+	}
+
+	/** Segments are kept for later reuse, they are given back only on destruction */
+	void pop_back()
+	{
+		assert(m_size > 0);
+		back().~T();
+		--m_size;
+	}
+
+	void clear()
+	{
+		while (m_size > 0)
+		{
+			pop_back();
+		}
+	}
+
+private:
+	/** Segment k starts at FIRST_SEGMENT_SIZE * (2^k - 1) */
+	static inline size_t GetSegment(size_t index)
+	{
+		return FloorLog2(index / FIRST_SEGMENT_SIZE + 1);
+	}
+	static inline size_t GetSegmentStart(size_t segment) { return FIRST_SEGMENT_SIZE * ((size_t(1) << segment) - 1); }
+	static inline size_t GetSegmentSize(size_t segment) { return FIRST_SEGMENT_SIZE << segment; }
+
+	T* m_segments[MAX_SEGMENTS] = {};
+	size_t m_size = 0;
+};
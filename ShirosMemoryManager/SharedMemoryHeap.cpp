@@ -0,0 +1,436 @@
+#include "pch.h"
+#include "SharedMemoryHeap.h"
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+	/** Blocks keep the alignment of FreeBlock */
+	constexpr size_t BLOCK_ALIGNMENT = alignof(std::max_align_t);
+	/** Segments are mapped on page boundaries, offsets aligned within a page are aligned in every process */
+	constexpr size_t MAX_ALIGNMENT = 4096;
+
+	inline uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+SharedMemoryHeap::SharedMemoryHeap(const char* Name, size_t Size)
+{
+	if (!Create(Name, Size, Backing::SHARED_MEMORY))
+	{
+		cout << "Shared memory segment " << Name << " could not be created" << endl;
+	}
+}
+
+SharedMemoryHeap::SharedMemoryHeap(const char* Name)
+{
+	if (Open(Name, Backing::SHARED_MEMORY) != OpenResult::OPENED)
+	{
+		cout << "Shared memory segment " << Name << " could not be opened" << endl;
+	}
+}
+
+SharedMemoryHeap::~SharedMemoryHeap()
+{
+	UnmapSegment();
+}
+
+void SharedMemoryHeap::Remove(const char* Name)
+{
+#ifndef _WIN32
+	shm_unlink(Name);
+#endif
+}
+
+bool SharedMemoryHeap::Create(const char* Name, size_t Size, Backing backing)
+{
+	assert(Name && Size > FIRST_BLOCK + sizeof(FreeBlock));
+
+#ifdef _WIN32
+	const uint64_t mappingSize = Size;
+	if (backing == Backing::FILE)
+	{
+		mp_file = CreateFileA(Name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mp_file == INVALID_HANDLE_VALUE) mp_file = nullptr;
+	}
+	if (backing == Backing::SHARED_MEMORY || mp_file)
+	{
+		//a file backed mapping is reached through its path, only shared memory needs a named mapping
+		mp_mapping = CreateFileMappingA(mp_file ? mp_file : INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), mp_file ? nullptr : Name);
+		if (mp_mapping && !mp_file && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(mp_mapping);
+			mp_mapping = nullptr;
+		}
+	}
+	const bool created = mp_mapping != nullptr;
+#else
+	//a new file is locked right away, a process opening it meanwhile finds no magic and gives up
+	m_fd = backing == Backing::FILE ? open(Name, O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(Name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	const bool created = m_fd >= 0 && (backing != Backing::FILE || flock(m_fd, LOCK_EX | LOCK_NB) == 0)
+		&& ftruncate(m_fd, static_cast<off_t>(Size)) == 0;
+#endif
+
+	if (!created || !MapSegment(Size) || !OpenLock(Name))
+	{
+		UnmapSegment();
+		return false;
+	}
+	return Format(Size);
+}
+
+bool SharedMemoryHeap::Format(size_t Size)
+{
+	assert(IsValid() && Size > FIRST_BLOCK + sizeof(FreeBlock));
+
+	if (Size != m_size)
+	{
+#ifdef _WIN32
+		//a mapping cannot change size, the file grows with the new one and keeps its tail when shrinking
+		UnmapViewOfFile(mp_base);
+		CloseHandle(mp_mapping);
+		mp_base = nullptr;
+		const uint64_t mappingSize = Size;
+		mp_mapping = mp_file ? CreateFileMappingA(mp_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), nullptr) : nullptr;
+		const bool resized = mp_mapping != nullptr;
+#else
+		munmap(mp_base, m_size);
+		mp_base = nullptr;
+		const bool resized = ftruncate(m_fd, static_cast<off_t>(Size)) == 0;
+#endif
+		if (!resized || !MapSegment(Size))
+		{
+			UnmapSegment();
+			return false;
+		}
+	}
+
+	//the whole segment after the header is a unique free block
+	SegmentHeader* header = GetHeader();
+	new(&header->magic) std::atomic<uint64_t>(0);
+	new(&header->damaged) std::atomic<uint32_t>(0);
+	new(&header->clean) std::atomic<uint32_t>(0);
+	for (size_t i = 0; i < ROOTS_COUNT; ++i)
+	{
+		new(&header->roots[i]) std::atomic<Offset>(NULL_OFFSET);
+	}
+	header->version = LAYOUT_VERSION;
+	header->size = Size;
+	header->used = 0;
+	header->freeHead = FIRST_BLOCK;
+
+	FreeBlock* first = GetBlock(FIRST_BLOCK);
+	first->blockSize = (Size - FIRST_BLOCK) & ~(BLOCK_ALIGNMENT - 1);
+	first->next = NULL_OFFSET;
+
+	//openers lock the heap as soon as they see the magic
+	if (!InitLock())
+	{
+		UnmapSegment();
+		return false;
+	}
+	header->magic.store(MAGIC, std::memory_order_release);
+	return true;
+}
+
+SharedMemoryHeap::OpenResult SharedMemoryHeap::Open(const char* Name, Backing backing)
+{
+	assert(Name);
+
+#ifdef _WIN32
+	if (backing == Backing::FILE)
+	{
+		//no sharing: the handle itself is the exclusive lock, released when closed
+		mp_file = CreateFileA(Name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mp_file == INVALID_HANDLE_VALUE)
+		{
+			mp_file = nullptr;
+			const DWORD error = GetLastError();
+			if (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) return OpenResult::NOT_FOUND;
+			if (error == ERROR_SHARING_VIOLATION) return OpenResult::IN_USE;
+			return OpenResult::FAILED;
+		}
+		mp_mapping = CreateFileMappingA(mp_file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	}
+	else
+	{
+		mp_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, Name);
+		if (!mp_mapping && GetLastError() == ERROR_FILE_NOT_FOUND) return OpenResult::NOT_FOUND;
+	}
+	//the size is known only once the header is readable, map the whole view
+	const bool opened = mp_mapping != nullptr && MapSegment(0);
+#else
+	m_fd = backing == Backing::FILE ? open(Name, O_RDWR) : shm_open(Name, O_RDWR, 0600);
+	if (m_fd < 0)
+	{
+		return errno == ENOENT ? OpenResult::NOT_FOUND : OpenResult::FAILED;
+	}
+	//the lock goes away with the descriptor, a crashed process does not keep the file locked
+	if (backing == Backing::FILE && flock(m_fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		const bool inUse = errno == EWOULDBLOCK;
+		UnmapSegment();
+		return inUse ? OpenResult::IN_USE : OpenResult::FAILED;
+	}
+	struct stat info;
+	const bool opened = fstat(m_fd, &info) == 0 && static_cast<size_t>(info.st_size) > FIRST_BLOCK
+		&& MapSegment(static_cast<size_t>(info.st_size));
+#endif
+
+	if (!opened || GetHeader()->magic.load(std::memory_order_acquire) != MAGIC || GetHeader()->version != LAYOUT_VERSION
+		|| !OpenLock(Name)
+		|| (backing == Backing::FILE && !InitLock())) //the file is locked for this process alone, the mutex left by a previous run is stale
+	{
+		UnmapSegment();
+		return OpenResult::FAILED;
+	}
+	m_size = static_cast<size_t>(GetHeader()->size);
+	return OpenResult::OPENED;
+}
+
+bool SharedMemoryHeap::MapSegment(size_t Size)
+{
+#ifdef _WIN32
+	mp_base = static_cast<unsigned char*>(MapViewOfFile(mp_mapping, FILE_MAP_ALL_ACCESS, 0, 0, Size));
+#else
+	void* ptr = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	mp_base = ptr != MAP_FAILED ? static_cast<unsigned char*>(ptr) : nullptr;
+#endif
+	m_size = Size;
+	return mp_base != nullptr;
+}
+
+void SharedMemoryHeap::UnmapSegment()
+{
+#ifdef _WIN32
+	if (mp_base) UnmapViewOfFile(mp_base);
+	if (mp_mapping) CloseHandle(mp_mapping);
+	if (mp_file) CloseHandle(mp_file);
+	if (mp_lock) CloseHandle(mp_lock);
+	mp_mapping = nullptr;
+	mp_file = nullptr;
+	mp_lock = nullptr;
+#else
+	if (mp_base) munmap(mp_base, m_size);
+	if (m_fd >= 0) close(m_fd);
+	m_fd = -1;
+#endif
+	mp_base = nullptr;
+	m_size = 0;
+}
+
+void SharedMemoryHeap::FlushSegment()
+{
+	assert(IsValid());
+#ifdef _WIN32
+	FlushViewOfFile(mp_base, 0);
+	if (mp_file) FlushFileBuffers(mp_file);
+#else
+	msync(mp_base, m_size, MS_SYNC);
+#endif
+}
+
+bool SharedMemoryHeap::InitLock()
+{
+#ifdef _WIN32
+	return true;
+#else
+	pthread_mutexattr_t attributes;
+	if (pthread_mutexattr_init(&attributes) != 0) return false;
+	const bool initialized = pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) == 0
+		&& pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) == 0
+		&& pthread_mutex_init(&GetHeader()->lock, &attributes) == 0;
+	pthread_mutexattr_destroy(&attributes);
+	return initialized;
+#endif
+}
+
+bool SharedMemoryHeap::OpenLock(const char* Name)
+{
+#ifdef _WIN32
+	//object names cannot contain backslashes, paths of FILE segments are flattened
+	char lockName[MAX_PATH + 32] = "Local\\ShiroHeapLock_";
+	size_t length = std::strlen(lockName);
+	for (; *Name && length + 1 < sizeof(lockName); ++Name, ++length)
+	{
+		lockName[length] = (*Name == '\\' || *Name == ':') ? '_' : *Name;
+	}
+	lockName[length] = '\0';
+	mp_lock = CreateMutexA(nullptr, FALSE, lockName);
+	return mp_lock != nullptr;
+#else
+	(void)Name;
+	return true;
+#endif
+}
+
+void SharedMemoryHeap::Lock()
+{
+#ifdef _WIN32
+	const bool ownerDied = WaitForSingleObject(mp_lock, INFINITE) == WAIT_ABANDONED;
+#else
+	pthread_mutex_t& lock = GetHeader()->lock;
+	const bool ownerDied = pthread_mutex_lock(&lock) == EOWNERDEAD;
+	if (ownerDied)
+	{
+		pthread_mutex_consistent(&lock);
+	}
+#endif
+	if (ownerDied)
+	{
+		//the free list may be left half updated, let the processes decide whether to trust the heap
+		GetHeader()->damaged.store(1, std::memory_order_release);
+		cout << "Shared memory heap lock holder died, the heap may be damaged" << endl;
+	}
+}
+
+void SharedMemoryHeap::Unlock()
+{
+#ifdef _WIN32
+	ReleaseMutex(mp_lock);
+#else
+	pthread_mutex_unlock(&GetHeader()->lock);
+#endif
+}
+
+void* SharedMemoryHeap::Allocate(size_t Size, size_t Alignment /* = alignof(std::max_align_t) */)
+{
+	assert(IsValid() && Size > 0);
+	assert((Alignment & (Alignment - 1)) == 0 && Alignment <= MAX_ALIGNMENT && "Alignment must be a power of two not exceeding a page");
+	if (Alignment < BLOCK_ALIGNMENT) Alignment = BLOCK_ALIGNMENT;
+
+	SegmentHeader* header = GetHeader();
+	Lock();
+
+	//first fit over the address ordered free list
+	Offset prev = NULL_OFFSET, current = header->freeHead;
+	uint64_t dataOffset = 0, requiredSize = 0;
+	for (; current != NULL_OFFSET; prev = current, current = GetBlock(current)->next)
+	{
+		dataOffset = AlignUp(current + sizeof(AllocatedBlockHeader), Alignment);
+		requiredSize = AlignUp(dataOffset + Size - current, BLOCK_ALIGNMENT);
+		if (requiredSize <= GetBlock(current)->blockSize) break;
+	}
+
+	if (current == NULL_OFFSET) //segment exhausted, let the caller decide
+	{
+		Unlock();
+		return nullptr;
+	}
+
+	FreeBlock* block = GetBlock(current);
+	uint64_t padding = dataOffset - sizeof(AllocatedBlockHeader) - current;
+	if (padding >= sizeof(FreeBlock))
+	{
+		//leading remainder stays free, the allocated block starts at its header
+		const Offset aligned = current + padding;
+		FreeBlock* alignedBlock = GetBlock(aligned);
+		alignedBlock->blockSize = block->blockSize - padding;
+		alignedBlock->next = block->next;
+		block->blockSize = padding;
+		block->next = aligned;
+
+		prev = current;
+		current = aligned;
+		block = alignedBlock;
+		requiredSize -= padding;
+		padding = 0;
+	}
+
+	Offset next = block->next;
+	if (block->blockSize - requiredSize < sizeof(FreeBlock))
+	{
+		//the remainder could not even host a free block, hand out the whole block
+		requiredSize = block->blockSize;
+	}
+	else
+	{
+		const Offset tail = current + requiredSize;
+		GetBlock(tail)->blockSize = block->blockSize - requiredSize;
+		GetBlock(tail)->next = next;
+		next = tail;
+	}
+
+	if (prev == NULL_OFFSET) header->freeHead = next;
+	else GetBlock(prev)->next = next;
+
+	AllocatedBlockHeader* allocated = reinterpret_cast<AllocatedBlockHeader*>(mp_base + dataOffset - sizeof(AllocatedBlockHeader));
+	allocated->blockSize = requiredSize;
+	allocated->padding = padding;
+	header->used += requiredSize;
+
+	Unlock();
+	return mp_base + dataOffset;
+}
+
+void SharedMemoryHeap::Deallocate(void* ptr)
+{
+	if (!ptr) return;
+	assert(IsValid() && Contains(ptr));
+
+	const AllocatedBlockHeader* allocated = reinterpret_cast<const AllocatedBlockHeader*>(static_cast<unsigned char*>(ptr) - sizeof(AllocatedBlockHeader));
+	const Offset offset = ToOffset(allocated) - allocated->padding;
+	const uint64_t blockSize = allocated->blockSize;
+
+	SegmentHeader* header = GetHeader();
+	Lock();
+
+	//keep the list address ordered so neighbours can be merged
+	Offset prev = NULL_OFFSET, next = header->freeHead;
+	while (next != NULL_OFFSET && next < offset)
+	{
+		prev = next;
+		next = GetBlock(next)->next;
+	}
+
+	FreeBlock* block = GetBlock(offset);
+	block->blockSize = blockSize;
+	block->next = next;
+	if (next != NULL_OFFSET && offset + block->blockSize == next)
+	{
+		block->blockSize += GetBlock(next)->blockSize;
+		block->next = GetBlock(next)->next;
+	}
+
+	if (prev == NULL_OFFSET)
+	{
+		header->freeHead = offset;
+	}
+	else if (prev + GetBlock(prev)->blockSize == offset)
+	{
+		GetBlock(prev)->blockSize += block->blockSize;
+		GetBlock(prev)->next = block->next;
+	}
+	else
+	{
+		GetBlock(prev)->next = offset;
+	}
+	header->used -= blockSize;
+
+	Unlock();
+}
+
+void SharedMemoryHeap::SetRoot(size_t Index, const void* ptr)
+{
+	assert(IsValid() && Index < ROOTS_COUNT);
+	assert(!ptr || Contains(ptr));
+	GetHeader()->roots[Index].store(ToOffset(ptr), std::memory_order_release);
+}
+
+size_t SharedMemoryHeap::GetUsedMemory() const
+{
+	return static_cast<size_t>(GetHeader()->used);
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+using std::size_t;
+
+/**
+ * Free list heap living in a named shared memory segment (POSIX shm_open, a named file mapping on Windows).
+ * Every process maps the segment at its own address, so the heap keeps no raw pointer:
+ * free blocks are linked by offsets from the segment start and the heap state sits in a header at offset 0.
+ * A producer allocates a message in place and hands the consumer its offset, the consumer reads it through its own mapping
+ * and any process can give the block back. Allocations are serialized by a robust process-shared mutex stored in the segment
+ * (a named mutex on Windows): a process dying while holding it does not block the others, which take the lock over
+ * and flag the heap as possibly damaged. Lock-free atomics are address free and therefore shared among processes.
+ * A small root table in the header lets processes find the entry points of the data structures built in the segment
+ */
+class SharedMemoryHeap
+{
+public:
+	/** Position of a block from the segment start, valid in every process mapping the segment */
+	using Offset = uint64_t;
+	static constexpr Offset NULL_OFFSET = 0;
+	static constexpr size_t ROOTS_COUNT = 16;
+
+	/** Create a segment of Size bytes, failing if Name already exists. POSIX names start with '/' */
+	SharedMemoryHeap(const char* Name, size_t Size);
+	/** Map an existing segment created by another SharedMemoryHeap */
+	explicit SharedMemoryHeap(const char* Name);
+	~SharedMemoryHeap();
+
+	/** Prevent copy for this class */
+	SharedMemoryHeap(const SharedMemoryHeap&) = delete;
+	SharedMemoryHeap& operator=(const SharedMemoryHeap&) = delete;
+
+	/** Remove the segment name, mappings still open stay valid. No-op on Windows, where the segment dies with its last handle */
+	static void Remove(const char* Name);
+
+	/** Whether the segment was created or opened correctly */
+	inline bool IsValid() const { return mp_base != nullptr; }
+
+	/** Thread and process safe. Returns nullptr when the segment cannot host the request */
+	void* Allocate(size_t Size, size_t Alignment = alignof(std::max_align_t));
+	/** Thread and process safe. ptr may come from the mapping of another process, once translated with FromOffset */
+	void Deallocate(void* ptr);
+
+	inline Offset ToOffset(const void* ptr) const
+	{
+		return ptr ? static_cast<Offset>(static_cast<const unsigned char*>(ptr) - mp_base) : NULL_OFFSET;
+	}
+	template <typename T = void>
+	inline T* FromOffset(Offset offset) const
+	{
+		return offset != NULL_OFFSET ? reinterpret_cast<T*>(mp_base + offset) : nullptr;
+	}
+
+	/** Thread and process safe. Publish the entry point ptr (nullptr to clear) under Index */
+	void SetRoot(size_t Index, const void* ptr);
+	template <typename T = void>
+	inline T* GetRoot(size_t Index) const
+	{
+		assert(Index < ROOTS_COUNT);
+		return FromOffset<T>(GetHeader()->roots[Index].load(std::memory_order_acquire));
+	}
+
+	/** Whether ptr lies inside the mapping of this process */
+	inline bool Contains(const void* ptr) const
+	{
+		return ptr >= mp_base && ptr < mp_base + m_size;
+	}
+
+	inline size_t GetSize() const { return m_size; }
+	/** Bytes allocated by all the processes, headers included */
+	size_t GetUsedMemory() const;
+	/** Whether a process died while allocating or deallocating: its update of the free list may be incomplete */
+	inline bool IsDamaged() const { return GetHeader()->damaged.load(std::memory_order_acquire) != 0; }
+
+protected:
+	/** Where the segment lives */
+	enum class Backing
+	{
+		/** Named shared memory, gone at reboot */
+		SHARED_MEMORY,
+		/** Regular file, survives the processes using it. It is locked for exclusive use while mapped */
+		FILE
+	};
+
+	/** Outcome of Open */
+	enum class OpenResult
+	{
+		OPENED,
+		/** Nothing exists under the name */
+		NOT_FOUND,
+		/** FILE segment locked by another process */
+		IN_USE,
+		/** Cannot be mapped, or does not hold a heap of this layout */
+		FAILED
+	};
+
+	static constexpr uint64_t MAGIC = 0x534849524F484541; //"SHIROHEA"
+	/** Bumped whenever the segment layout changes, segments of another version are rejected */
+	static constexpr uint64_t LAYOUT_VERSION = 2;
+
+	/** Heap state, at offset 0 of the segment */
+	struct SegmentHeader
+	{
+		/** Written last by the creator, openers check it */
+		std::atomic<uint64_t> magic;
+		uint64_t version;
+		uint64_t size;
+#ifndef _WIN32
+		/** Process-shared and robust. Windows uses a named mutex instead */
+		pthread_mutex_t lock;
+#endif
+		/** Set when a lock holder died, never cleared */
+		std::atomic<uint32_t> damaged;
+		/** Cleared while a FILE segment is open, set back on a clean close */
+		std::atomic<uint32_t> clean;
+		Offset freeHead;
+		uint64_t used;
+		std::atomic<Offset> roots[ROOTS_COUNT];
+	};
+
+	SharedMemoryHeap() = default;
+
+	/** Create and format a new segment. Returns false, leaving the heap invalid, if it already exists or cannot be mapped */
+	bool Create(const char* Name, size_t Size, Backing backing);
+	/** Map an existing segment. The heap is left invalid unless the segment is OPENED */
+	OpenResult Open(const char* Name, Backing backing);
+	/** Format the mapped segment as an empty heap of Size bytes, resizing its backing store first if needed. Returns false, leaving the heap invalid, on failure */
+	bool Format(size_t Size);
+	void UnmapSegment();
+	/** Write the dirty pages of the segment back to its backing store */
+	void FlushSegment();
+
+	inline SegmentHeader* GetHeader() const { return reinterpret_cast<SegmentHeader*>(mp_base); }
+
+private:
+	/** Internal struct identifying a free block. Links are offsets */
+	struct FreeBlock
+	{
+		uint64_t blockSize;
+		Offset next;
+	};
+
+	/** Internal struct identifying an allocated block, right before the returned address */
+	struct AllocatedBlockHeader
+	{
+		uint64_t blockSize;
+		/** Bytes between the block start and the header */
+		uint64_t padding;
+	};
+
+	/** Offset of the first block, blocks are aligned as FreeBlock */
+	static constexpr size_t FIRST_BLOCK = (sizeof(SegmentHeader) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+	inline FreeBlock* GetBlock(Offset offset) const { return reinterpret_cast<FreeBlock*>(mp_base + offset); }
+
+	/** Initialize the mutex in the header of a segment no other process is using. No-op on Windows */
+	bool InitLock();
+	/** Open or create the named mutex of the segment. No-op outside Windows */
+	bool OpenLock(const char* Name);
+	void Lock();
+	void Unlock();
+
+	/** Map the segment handle, Size bytes from the start */
+	bool MapSegment(size_t Size);
+
+	unsigned char* mp_base = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* mp_mapping = nullptr;
+	/** File handle of FILE segments */
+	void* mp_file = nullptr;
+	/** Named mutex serializing the processes */
+	void* mp_lock = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
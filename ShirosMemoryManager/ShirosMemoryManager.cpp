@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "ShirosMemoryManager.h"
+#include "Tracepoints.h"
 
 ShirosMMCreationParams ShirosMemoryManager::mmCreationParams = ShirosMMCreationParams();
 
@@ -15,23 +16,54 @@ void ShirosMemoryManager::Init(const ShirosMMCreationParams& params)
 }
 
 ShirosMemoryManager::ShirosMemoryManager()
-	: m_smallObjAllocator(mmCreationParams.chunkSize),
-	m_freeListAllocator(mmCreationParams.freeListMemoryPoolSize, mmCreationParams.freeListFitPolicy)
+	: m_mem_freed_remotely(0),
+	m_mem_allocated_remotely(0),
+	m_trackLatency(mmCreationParams.trackLatency),
+	m_ownerThread(std::this_thread::get_id()),
+	m_smallObjAllocator(mmCreationParams.chunkSize, mmCreationParams.maxSizeForSmallObj, mmCreationParams.smallObjFreeTracking,
+		mmCreationParams.smallObjChunkRetention, mmCreationParams.smallObjChunkRetentionProvider, mmCreationParams.useHugePages,
+		mmCreationParams.smallObjChunkColouring),
+	m_largeObjArenas(mmCreationParams.freeListMemoryPoolSize, mmCreationParams.largeObjArenasCount, mmCreationParams.freeListFitPolicy,
+		mmCreationParams.largeObjArenaSelection, mmCreationParams.useHugePages)
 {
 
 }
 
 ShirosMemoryManager::~ShirosMemoryManager()
 {
+	DiscardRemoteFrees();
 	cout << "===== RELEASED ALLOCATED MEMORY ======" << endl;
 }
 
 void* ShirosMemoryManager::Allocate(size_t ObjSize, AllocationType AllocType, size_t Alignment /* = alignof(std::max_align_t) */)
 {	
+	if (std::this_thread::get_id() != m_ownerThread)
+	{
+		return AllocateRemote(ObjSize, AllocType, Alignment);
+	}
+	DrainRemoteFrees();
+
+	if (m_trackLatency)
+	{
+		const uint64_t start = LatencyHistogram::ReadTicks();
+		void* p_res = AllocateOwned(ObjSize, AllocType, Alignment);
+		const uint64_t elapsed = LatencyHistogram::ReadTicks() - start;
+
+		const LatencyTier tier = AllocType == AllocationType::Collection ? LatencyTier::Array
+			: (CanBeHandledWithSmallObjAllocator(ObjSize, Alignment) ? LatencyTier::Small : LatencyTier::Large);
+		m_allocationLatency[static_cast<size_t>(tier)].Record(elapsed);
+		return p_res;
+	}
+
+	return AllocateOwned(ObjSize, AllocType, Alignment);
+}
+
+void* ShirosMemoryManager::AllocateOwned(size_t ObjSize, AllocationType AllocType, size_t Alignment)
+{
 	void* p_res = nullptr;
 
 	size_t AllocationSize;
-	if (CanBeHandledWithSmallObjAllocator(ObjSize))
+	if (CanBeHandledWithSmallObjAllocator(ObjSize, Alignment))
 	{
 		p_res = m_smallObjAllocator.Allocate(ObjSize, AllocationSize);
 #ifdef MM_DEBUG
@@ -41,7 +73,7 @@ void* ShirosMemoryManager::Allocate(size_t ObjSize, AllocationType AllocType, si
 	}
 	else
 	{
-		p_res = m_freeListAllocator.Allocate(ObjSize, Alignment, AllocationSize);
+		p_res = m_largeObjArenas.Allocate(ObjSize, Alignment, AllocationSize);
 #ifdef MM_DEBUG
 		cout << "Requested size is larger than MAX_SMALL_OBJECT_SIZE(" << MAX_SMALL_OBJECT_SIZE << ")";
 		cout << ". Allocated memory using FreeListAllocator" << endl;
@@ -57,6 +89,12 @@ void* ShirosMemoryManager::Allocate(size_t ObjSize, AllocationType AllocType, si
 		if (AllocType == AllocationType::Collection)
 		{
 			m_arrayAllocationMap[p_res] = ObjSize;
+			SHIRO_MM_TRACE3(array_map_insert, p_res, ObjSize, m_arrayAllocationMap.size());
+		}
+		else if (!m_arrayAllocationMap.empty())
+		{
+			//a Collection released with its size, by any thread, leaves its entry behind until the address is handed out here again
+			m_arrayAllocationMap.erase(p_res);
 		}
 
 		m_mem_used += AllocationSize;
@@ -70,6 +108,35 @@ void* ShirosMemoryManager::Allocate(size_t ObjSize, AllocationType AllocType, si
 	return p_res;
 }
 
+ShirosMemoryManager::AllocationResult ShirosMemoryManager::AllocateAtLeast(size_t ObjSize, size_t Alignment /* = alignof(std::max_align_t) */)
+{
+	void* p_res = Allocate(ObjSize, AllocationType::Single, Alignment);
+	return AllocationResult{ p_res, p_res ? UsableSize(p_res, ObjSize) : 0 };
+}
+
+size_t ShirosMemoryManager::UsableSize(void* ptr, size_t ObjSize /* = 0 */)
+{
+	if (!ptr) return 0;
+
+	//large blocks carry a header, alignment padding and split remainder are part of them
+	if (m_largeObjArenas.Contains(ptr))
+	{
+		return m_largeObjArenas.GetUsableSize(ptr);
+	}
+
+	if (ObjSize == 0 && std::this_thread::get_id() == m_ownerThread)
+	{
+		ArrayAllocationMap::const_iterator it = m_arrayAllocationMap.find(ptr);
+		if (it != m_arrayAllocationMap.end())
+		{
+			ObjSize = it->second;
+		}
+	}
+
+	assert(ObjSize > 0 && CanBeHandledWithSmallObjAllocator(ObjSize) && "Small blocks need their requested size");
+	return ObjSize > 0 ? SmallObjAllocator::GetBlockSize(ObjSize) : 0;
+}
+
 void ShirosMemoryManager::Deallocate(void* ptr, size_t ObjSize /* = 0 */)
 {
 	if (!ptr) //bad argument
@@ -78,10 +145,34 @@ void ShirosMemoryManager::Deallocate(void* ptr, size_t ObjSize /* = 0 */)
 		return;
 	}
 
+	if (std::this_thread::get_id() != m_ownerThread)
+	{
+		DeallocateRemote(ptr, ObjSize);
+		return;
+	}
+	DrainRemoteFrees();
+
+	if (m_trackLatency)
+	{
+		//the tier is resolved before the block is given back, its address may be reused right after
+		const LatencyTier tier = ObjSize == 0 ? LatencyTier::Array
+			: (IsSmallObjBlock(ptr, ObjSize) ? LatencyTier::Small : LatencyTier::Large);
+
+		const uint64_t start = LatencyHistogram::ReadTicks();
+		DeallocateOwned(ptr, ObjSize);
+		m_deallocationLatency[static_cast<size_t>(tier)].Record(LatencyHistogram::ReadTicks() - start);
+		return;
+	}
+
+	DeallocateOwned(ptr, ObjSize);
+}
+
+void ShirosMemoryManager::DeallocateOwned(void* ptr, size_t ObjSize)
+{
 	//if ObjSize is empty, check if ptr is key of internal array map 
 	if (ObjSize == 0)
 	{
-		std::map<void*, size_t>::iterator it = m_arrayAllocationMap.find(ptr);
+		ArrayAllocationMap::iterator it = m_arrayAllocationMap.find(ptr);
 		if (it != m_arrayAllocationMap.end())
 		{
 			ObjSize = it->second;
@@ -95,13 +186,13 @@ void ShirosMemoryManager::Deallocate(void* ptr, size_t ObjSize /* = 0 */)
 	}
 
 	size_t DeallocatedSize = 0;
-	if (CanBeHandledWithSmallObjAllocator(ObjSize))
+	if (IsSmallObjBlock(ptr, ObjSize))
 	{
 		DeallocatedSize = m_smallObjAllocator.Deallocate(ptr, ObjSize);
 	}
 	else 
 	{
-		DeallocatedSize = m_freeListAllocator.Deallocate(ptr);
+		DeallocatedSize = m_largeObjArenas.Deallocate(ptr);
 	}
 	
 	assert(DeallocatedSize > 0 && "Deallocated size must be greater than zero");
@@ -114,19 +205,279 @@ void ShirosMemoryManager::Deallocate(void* ptr, size_t ObjSize /* = 0 */)
 	m_mem_freed += DeallocatedSize;
 }
 
-bool ShirosMemoryManager::CanBeHandledWithSmallObjAllocator(size_t ObjSize) const
+size_t ShirosMemoryManager::AllocateBatch(size_t ObjSize, size_t Count, void** OutPtrs, size_t Alignment /* = alignof(std::max_align_t) */)
+{
+	if (ObjSize == 0 || Count == 0 || !OutPtrs) //bad argument
+	{
+		cout << "Aborting batch allocation. Bad argument: size: " << ObjSize << " count: " << Count << endl;
+		return 0;
+	}
+
+	//as in AllocateRemote, small object allocators belong to the owner, other threads are served by the arenas
+	const bool isOwner = std::this_thread::get_id() == m_ownerThread;
+
+	size_t Allocated = 0;
+	size_t TotalAllocationSize = 0;
+	if (isOwner && CanBeHandledWithSmallObjAllocator(ObjSize, Alignment))
+	{
+		size_t AllocationSize;
+		Allocated = m_smallObjAllocator.AllocateBatch(ObjSize, Count, OutPtrs, AllocationSize);
+		TotalAllocationSize = Allocated * AllocationSize;
+	}
+	else
+	{
+		for (; Allocated < Count; ++Allocated)
+		{
+			size_t AllocationSize;
+			OutPtrs[Allocated] = m_largeObjArenas.Allocate(ObjSize, Alignment, AllocationSize);
+			if (!OutPtrs[Allocated]) break;
+			TotalAllocationSize += AllocationSize;
+		}
+	}
+
+#ifdef MM_DEBUG
+	cout << "Allocated " << Allocated << " blocks for a total of " << TotalAllocationSize << " bytes" << endl;
+#endif
+
+	if (!isOwner)
+	{
+		m_mem_allocated_remotely.fetch_add(TotalAllocationSize, std::memory_order_relaxed);
+		return Allocated;
+	}
+
+	m_mem_used += TotalAllocationSize;
+	m_mem_allocated += TotalAllocationSize;
+
+	return Allocated;
+}
+
+void ShirosMemoryManager::DeallocateBatch(void* const* Ptrs, size_t Count, size_t ObjSize)
+{
+	if (!Ptrs || ObjSize == 0) //bad argument
+	{
+		cout << "Aborting batch deallocation. Bad argument: size: " << ObjSize << endl;
+		return;
+	}
+	if (Count == 0) return;
+
+	if (std::this_thread::get_id() != m_ownerThread)
+	{
+		for (size_t i = 0; i < Count; ++i)
+		{
+			DeallocateRemote(Ptrs[i], ObjSize);
+		}
+		return;
+	}
+
+	size_t TotalDeallocatedSize = 0;
+	if (IsSmallObjBlock(Ptrs[0], ObjSize))
+	{
+		TotalDeallocatedSize = Count * m_smallObjAllocator.DeallocateBatch(Ptrs, Count, ObjSize);
+	}
+	else
+	{
+		for (size_t i = 0; i < Count; ++i)
+		{
+			TotalDeallocatedSize += m_largeObjArenas.Deallocate(Ptrs[i]);
+		}
+	}
+
+#ifdef MM_DEBUG
+	cout << "Deallocated " << Count << " blocks for a total of " << TotalDeallocatedSize << " bytes" << endl;
+#endif
+
+	m_mem_used -= TotalDeallocatedSize;
+	m_mem_freed += TotalDeallocatedSize;
+}
+
+void ShirosMemoryManager::DeallocateRemote(void* ptr, size_t ObjSize)
+{
+	if (!ptr) //bad argument
+	{
+		cout << "Aborting remote deallocation. Bad argument: address: " << ptr << endl;
+		return;
+	}
+
+	//without a size the block is a Collection: only the owner can read its size and erase its map entry
+	if (ObjSize == 0)
+	{
+		void* record = std::malloc(sizeof(RemoteFree));
+		if (!record)
+		{
+			cout << "Aborting remote deallocation. Out of memory handing over address: " << ptr << endl;
+			return;
+		}
+		RemoteFree* remoteFree = new(record) RemoteFree{ nullptr, ptr };
+		remoteFree->next = mp_remoteFrees.load(std::memory_order_relaxed);
+		while (!mp_remoteFrees.compare_exchange_weak(remoteFree->next, remoteFree, std::memory_order_release, std::memory_order_relaxed));
+		return;
+	}
+
+	//arenas are thread-safe, large blocks go straight back to the arena owning them
+	const size_t DeallocatedSize = IsSmallObjBlock(ptr, ObjSize)
+		? m_smallObjAllocator.DeallocateRemote(ptr, ObjSize)
+		: m_largeObjArenas.Deallocate(ptr);
+	m_mem_freed_remotely.fetch_add(DeallocatedSize, std::memory_order_relaxed);
+}
+
+void ShirosMemoryManager::DrainRemoteFrees()
 {
-	return ObjSize <= mmCreationParams.maxSizeForSmallObj;
+	if (mp_remoteFrees.load(std::memory_order_relaxed) == nullptr) return; //nothing to do, avoid the atomic exchange
+
+	RemoteFree* it = mp_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+	while (it)
+	{
+		RemoteFree* next = it->next;
+		ArrayAllocationMap::iterator entry = m_arrayAllocationMap.find(it->ptr);
+		if (entry != m_arrayAllocationMap.end())
+		{
+			const size_t ObjSize = entry->second;
+			m_arrayAllocationMap.erase(entry);
+			DeallocateOwned(it->ptr, ObjSize);
+		}
+		else
+		{
+			cout << "Aborting remote deallocation. Address is not a Collection: " << it->ptr << endl;
+		}
+		std::free(it);
+		it = next;
+	}
+}
+
+void ShirosMemoryManager::DiscardRemoteFrees()
+{
+	//pending blocks go away with the allocators, only the records are freed
+	RemoteFree* it = mp_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+	while (it)
+	{
+		RemoteFree* next = it->next;
+		std::free(it);
+		it = next;
+	}
+}
+
+size_t ShirosMemoryManager::GetArrayAllocationsCount()
+{
+	assert(std::this_thread::get_id() == m_ownerThread && "Only the owner can access the array allocation map");
+	DrainRemoteFrees();
+	return m_arrayAllocationMap.size();
+}
+
+void* ShirosMemoryManager::AllocateRemote(size_t ObjSize, AllocationType AllocType, size_t Alignment)
+{
+	//small object allocators and the array allocation map belong to the owner.
+	//small requests are served by the arenas too, their blocks are recognized by address when released
+	assert(AllocType == AllocationType::Single && "Only the owner thread can allocate collections");
+
+	size_t AllocationSize;
+	void* p_res = m_largeObjArenas.Allocate(ObjSize, Alignment, AllocationSize);
+	if (!p_res)
+	{
+		cout << "Allocation didn't complete correctly" << endl;
+		return nullptr;
+	}
+
+	m_mem_allocated_remotely.fetch_add(AllocationSize, std::memory_order_relaxed);
+	return p_res;
 }
 
 void ShirosMemoryManager::PrintMemoryState()
 {
-	size_t m_totAllocatedMemory = m_smallObjAllocator.GetTotalAllocatedMemory() + m_freeListAllocator.GetTotalAllocatedMemory();
+	size_t m_totAllocatedMemory = m_smallObjAllocator.GetTotalAllocatedMemory() + m_largeObjArenas.GetTotalAllocatedMemory();
 	cout << "===== MEMORY STATE ======" << endl;
 	cout << "| Total Memory Allocated: " << m_totAllocatedMemory << " |" << endl;
 	cout << "| Memory Allocated: " << m_mem_allocated << " |" << endl;
-	cout << "| Memory Freed: " << m_mem_freed << " |" << endl;
-	cout << "| Memory Currently used: " << m_mem_used << " |" << endl;
+	cout << "| Memory Freed: " << GetMemoryFreed() << " |" << endl;
+	cout << "| Memory Currently used: " << GetCurrentlyUsedMemory() << " |" << endl;
+	const ChunkStats chunkStats = m_smallObjAllocator.GetChunkStats();
+	cout << "| Chunks Created: " << chunkStats.created << " Destroyed: " << chunkStats.destroyed << " Empty: " << chunkStats.empty << " |" << endl;
+}
+
+MemoryFootprint ShirosMemoryManager::GetSmallObjFootprint() const
+{
+	assert(std::this_thread::get_id() == m_ownerThread && "Only the owner can walk the small object chunks");
+	return m_smallObjAllocator.GetMemoryFootprint();
+}
+
+MemoryFootprint ShirosMemoryManager::GetLargeObjFootprint()
+{
+	return m_largeObjArenas.GetMemoryFootprint();
+}
+
+size_t ShirosMemoryManager::GetArrayMapFootprint() const
+{
+	assert(std::this_thread::get_id() == m_ownerThread && "Only the owner can access the array allocation map");
+	//each node holds the entry, parent, left and right links and a colour padded to a word
+	constexpr size_t NodeSize = sizeof(ArrayAllocationMap::value_type) + 4 * sizeof(void*);
+	return m_arrayAllocationMap.size() * NodeSize;
+}
+
+MemoryFootprint ShirosMemoryManager::GetMemoryFootprint()
+{
+	MemoryFootprint footprint = GetSmallObjFootprint();
+	footprint += GetLargeObjFootprint();
+	footprint.metadataBytes += sizeof(ShirosMemoryManager) + GetArrayMapFootprint();
+	return footprint;
+}
+
+void ShirosMemoryManager::PrintMemoryFootprint()
+{
+	const auto PrintFootprint = [](const char* Tier, const MemoryFootprint& footprint) {
+		cout << "| " << Tier << ": reserved " << footprint.GetReservedBytes() << " allocated " << footprint.allocatedBytes << " free " << footprint.freeBytes
+			<< " metadata " << footprint.metadataBytes << " wasted " << footprint.wastedBytes << " |" << endl;
+	};
+
+	cout << "===== MEMORY FOOTPRINT ======" << endl;
+	PrintFootprint("Small objects", GetSmallObjFootprint());
+	PrintFootprint("Large objects", GetLargeObjFootprint());
+	cout << "| Array map: " << m_arrayAllocationMap.size() << " entries, " << GetArrayMapFootprint() << " bytes |" << endl;
+	PrintFootprint("Total", GetMemoryFootprint());
+}
+
+void ShirosMemoryManager::SetLatencyTracking(bool Enabled)
+{
+	assert(std::this_thread::get_id() == m_ownerThread && "Only the owner can toggle latency tracking");
+	m_trackLatency = Enabled;
+}
+
+void ShirosMemoryManager::ResetLatency()
+{
+	for (size_t i = 0; i < static_cast<size_t>(LatencyTier::Count); ++i)
+	{
+		m_allocationLatency[i].Reset();
+		m_deallocationLatency[i].Reset();
+	}
+}
+
+void ShirosMemoryManager::PrintLatency() const
+{
+	static const char* const TierNames[] = { "Small", "Large", "Array" };
+	const auto PrintHistogram = [](const char* Operation, const char* Tier, const LatencyHistogram& histogram) {
+		if (histogram.GetCount() == 0) return;
+		cout << "| " << Operation << " " << Tier << ": count " << histogram.GetCount()
+			<< " p50 " << LatencyHistogram::ToNanoseconds(histogram.GetPercentile(50.0)) << "ns"
+			<< " p99 " << LatencyHistogram::ToNanoseconds(histogram.GetPercentile(99.0)) << "ns"
+			<< " p99.9 " << LatencyHistogram::ToNanoseconds(histogram.GetPercentile(99.9)) << "ns"
+			<< " max " << LatencyHistogram::ToNanoseconds(histogram.GetMax()) << "ns |" << endl;
+	};
+
+	cout << "===== LATENCY ======" << endl;
+	for (size_t i = 0; i < static_cast<size_t>(LatencyTier::Count); ++i)
+	{
+		PrintHistogram("Allocate", TierNames[i], m_allocationLatency[i]);
+		PrintHistogram("Deallocate", TierNames[i], m_deallocationLatency[i]);
+	}
+}
+
+void ShirosMemoryManager::TrimEmptyChunks()
+{
+	assert(std::this_thread::get_id() == m_ownerThread && "Only the owner can release chunks");
+	m_smallObjAllocator.TrimEmptyChunks();
+}
+
+ChunkStats ShirosMemoryManager::GetSmallObjChunkStats(size_t ObjSize /* = 0 */) const
+{
+	return ObjSize == 0 ? m_smallObjAllocator.GetChunkStats() : m_smallObjAllocator.GetChunkStats(ObjSize);
 }
 
 void ShirosMemoryManager::Reset()
@@ -134,6 +485,10 @@ void ShirosMemoryManager::Reset()
 	m_mem_allocated = 0;
 	m_mem_freed = 0;
 	m_mem_used = 0;
-	m_freeListAllocator.Reset();
+	m_mem_freed_remotely.store(0, std::memory_order_relaxed);
+	m_mem_allocated_remotely.store(0, std::memory_order_relaxed);
+	DiscardRemoteFrees();
+	m_arrayAllocationMap.clear();
+	m_largeObjArenas.Reset();
 	m_smallObjAllocator.Reset();
 }
\ No newline at end of file
@@ -1,9 +1,12 @@
 #pragma once
 #include "SmallObjAllocator.h"
-#include "FreeListAllocator.h"
+#include "LargeObjArenas.h"
+#include "LatencyHistogram.h"
 #include "Mallocator.h"
 #include <iostream>
 #include <map>
+#include <atomic>
+#include <thread>
 
 using std::cout;
 using std::endl;
@@ -18,10 +21,26 @@ struct ShirosMMCreationParams
 	size_t chunkSize = DEFAULT_CHUNK_SIZE;
 	/** Max size manageable by SmallObjAllocator. Default is 128 bytes */
 	size_t maxSizeForSmallObj = MAX_SMALL_OBJECT_SIZE;
+	/** How SmallObjAllocator chunks track their free blocks. Default is an intrusive free list */
+	FixedAllocator::FreeTracking smallObjFreeTracking = FixedAllocator::FreeTracking::FREE_LIST;
+	/** How many empty chunks each SmallObjAllocator size class keeps. Default is a single empty chunk */
+	ChunkRetentionPolicy smallObjChunkRetention;
+	/** Optional per size class override of smallObjChunkRetention. Default is none */
+	RetentionPolicyProvider smallObjChunkRetentionProvider = nullptr;
+	/** Back FreeListAllocator pool and SmallObjAllocator chunks with huge pages, falling back to transparent huge pages. Default is disabled */
+	bool useHugePages = false;
+	/** Start the blocks of each new SmallObjAllocator chunk at a rotating offset within the chunk slack, to spread them across cache sets. Default is disabled */
+	bool smallObjChunkColouring = false;
 	/** Memory pool to preallocate for FreeListAllocator. Default is 1MB */
 	size_t freeListMemoryPoolSize = 67108864;  // 64 MB
 	/** Fit policy to use for FreeListAllocator. Default is BestFit*/
 	FreeListAllocator::FitPolicy freeListFitPolicy = FreeListAllocator::FitPolicy::BEST_FIT;
+	/** Number of independent FreeListAllocator arenas sharing the memory pool, 0 means one per hardware thread. Default is a single arena */
+	size_t largeObjArenasCount = 1;
+	/** How a thread picks its large object arena. Default is the arena of the current CPU */
+	LargeObjArenas::ArenaSelection largeObjArenaSelection = LargeObjArenas::ArenaSelection::PER_CPU;
+	/** Time every Allocate and Deallocate of the owner thread into per tier latency histograms. Default is disabled */
+	bool trackLatency = false;
 };
 
 class ShirosMemoryManager /*Singleton*/
@@ -32,49 +51,202 @@ public:
 		Single,
 		Collection
 	};
+
+	/** Allocator path a request goes through, latency is tracked separately for each one */
+	enum class LatencyTier
+	{
+		Small,
+		Large,
+		Array,
+		Count
+	};
+
+	/** Mirrors std::allocation_result: the allocated address and the bytes effectively usable from it */
+	struct AllocationResult
+	{
+		void* ptr;
+		size_t count;
+	};
 	
 	/** Use this initialization function to override Memory Manager default creation parameters */
 	/** BE CAREFUL: Values is not checked, its up to the client to give consistent values */
 	static void Init(const ShirosMMCreationParams& params);
 	static ShirosMemoryManager& Get();
+	/** Requests up to this size (included) are served by SmallObjAllocator */
+	static inline size_t GetMaxSmallObjectSize() { return mmCreationParams.maxSizeForSmallObj; }
 
 	~ShirosMemoryManager();
 	/** Prevent copy for this class */
 	ShirosMemoryManager(const ShirosMemoryManager&) = delete;
 	ShirosMemoryManager& operator=(const ShirosMemoryManager&) = delete;
 
+	/** Threads other than the owner can allocate only single objects, which are served by the thread-safe arenas whatever their size */
 	void* Allocate(size_t ObjSize, AllocationType AllocType, size_t Alignment = alignof(std::max_align_t));
+	/** 
+	 * Allocates memory for a single T. Allocator tier and size class are computed at compile time,
+	 * so for small objects the fast path is inlined down to the chunk free list pop
+	 */
+	template <typename T>
+	inline void* Allocate();
+	/** 
+	 * Allocates a single object of at least ObjSize bytes and reports the real capacity of the block, as C++23 std::allocate_at_least.
+	 * The whole capacity can be used, and the block can be deallocated passing either ObjSize or the returned count
+	 */
+	AllocationResult AllocateAtLeast(size_t ObjSize, size_t Alignment = alignof(std::max_align_t));
+	/** 
+	 * Bytes usable from a block returned by the Memory Manager. Large blocks are recognized by address,
+	 * small blocks need ObjSize as Deallocate does (the owner can omit it for Collection allocations)
+	 */
+	size_t UsableSize(void* ptr, size_t ObjSize = 0);
+	/** Deallocates memory of a single T allocated either with Allocate<T> or with Allocate(sizeof(T), Single) */
+	template <typename T>
+	inline void Deallocate(void* ptr);
+	/** Deallocation requested by a thread other than the owner is automatically forwarded to DeallocateRemote */
 	void Deallocate(void* ptr, size_t ObjSize = 0);
+	/** 
+	 * Thread-safe. Deallocation performed by a thread that does not own the Memory Manager.
+	 * Small objects are pushed on lock-free lists and given back by the owner on its next allocation slow path,
+	 * large objects go straight back to their arena.
+	 * The array allocation map can be accessed only by the owner: Collections released without their size (ObjSize 0) are handed over
+	 * to the owner, which looks up and erases their entry on its next Allocate or Deallocate
+	 */
+	void DeallocateRemote(void* ptr, size_t ObjSize);
+	/** 
+	 * Allocates Count objects of the same size paying dispatch and bookkeeping once for the whole batch.
+	 * Returns the number of addresses written in OutPtrs. As with Allocate, batches of threads other than the owner are served by the arenas
+	 */
+	size_t AllocateBatch(size_t ObjSize, size_t Count, void** OutPtrs, size_t Alignment = alignof(std::max_align_t));
+	/** Deallocates Count objects of the same size previously allocated, either with AllocateBatch or not */
+	void DeallocateBatch(void* const* Ptrs, size_t Count, size_t ObjSize);
 	
 	void Reset();
 	void PrintMemoryState();
+	/** Give back the small object chunks exceeding their retention policy. Time based policies rely on it when an allocator goes idle */
+	void TrimEmptyChunks();
+	/** Chunk counters of the size class serving ObjSize, or of all the size classes when ObjSize is 0 */
+	ChunkStats GetSmallObjChunkStats(size_t ObjSize = 0) const;
+
+	/** Owner only. Chunks of every size class, their descriptors and the allocator pool */
+	MemoryFootprint GetSmallObjFootprint() const;
+	/** Large object pools, block headers and alignment padding. The whole pool is reserved up front and counted as free until used */
+	MemoryFootprint GetLargeObjFootprint();
+	/** Owner only. Collections tracked by the array allocation map, after giving back the ones released remotely */
+	size_t GetArrayAllocationsCount();
+	/** Owner only. Bytes of the array allocation map nodes, estimated from the usual red-black tree node layout */
+	size_t GetArrayMapFootprint() const;
+	/** Owner only. Footprint of the whole Memory Manager, itself and the array map included as metadata */
+	MemoryFootprint GetMemoryFootprint();
+	void PrintMemoryFootprint();
 
-	inline const size_t GetCurrentlyUsedMemory() { return m_mem_used; }
-	inline const size_t GetMemoryRequested() { return m_mem_allocated; }
-	inline const size_t GetMemoryFreed() { return m_mem_freed; }
+	/** 
+	 * Owner only. While enabled, Allocate and Deallocate calls of the owner are timed with the cycle counter.
+	 * Compile time typed paths fall back to the generic ones, so every request is accounted in its tier
+	 */
+	void SetLatencyTracking(bool Enabled);
+	inline bool IsTrackingLatency() const { return m_trackLatency; }
+	inline const LatencyHistogram& GetAllocationLatency(LatencyTier Tier) const { return m_allocationLatency[static_cast<size_t>(Tier)]; }
+	inline const LatencyHistogram& GetDeallocationLatency(LatencyTier Tier) const { return m_deallocationLatency[static_cast<size_t>(Tier)]; }
+	void ResetLatency();
+	/** p50, p99, p99.9 and max of every tier with records, in nanoseconds */
+	void PrintLatency() const;
+
+	inline const size_t GetCurrentlyUsedMemory() { return m_mem_used + m_mem_allocated_remotely.load(std::memory_order_relaxed) - m_mem_freed_remotely.load(std::memory_order_relaxed); }
+	inline const size_t GetMemoryRequested() { return m_mem_allocated + m_mem_allocated_remotely.load(std::memory_order_relaxed); }
+	inline const size_t GetMemoryFreed() { return m_mem_freed + m_mem_freed_remotely.load(std::memory_order_relaxed); }
 private:
 	ShirosMemoryManager();
 	static ShirosMMCreationParams mmCreationParams;
 
-	bool CanBeHandledWithSmallObjAllocator(size_t ObjSize) const;
+	inline bool CanBeHandledWithSmallObjAllocator(size_t ObjSize) const { return ObjSize <= mmCreationParams.maxSizeForSmallObj; }
+	/** Over-aligned requests are served by the arenas whatever their size, chunk blocks are only naturally aligned */
+	inline bool CanBeHandledWithSmallObjAllocator(size_t ObjSize, size_t Alignment) const { return CanBeHandledWithSmallObjAllocator(ObjSize) && Alignment <= alignof(std::max_align_t); }
+	/** Small sized blocks may still come from the arenas when they were over-aligned, the address tells */
+	inline bool IsSmallObjBlock(const void* ptr, size_t ObjSize) const { return CanBeHandledWithSmallObjAllocator(ObjSize) && !m_largeObjArenas.Contains(ptr); }
+	/** Allocation requested by a thread other than the owner, served by the arenas even for small sizes */
+	void* AllocateRemote(size_t ObjSize, AllocationType AllocType, size_t Alignment);
+	/** Allocate and Deallocate bodies, run by the owner thread */
+	void* AllocateOwned(size_t ObjSize, AllocationType AllocType, size_t Alignment);
+	void DeallocateOwned(void* ptr, size_t ObjSize);
+	/** Owner only. Releases the Collections handed over by DeallocateRemote, erasing their array map entry */
+	void DrainRemoteFrees();
+	/** Drops the records of the pending remote releases, their blocks are given back with the allocators */
+	void DiscardRemoteFrees();
 
 	size_t m_mem_used = 0;
 	size_t m_mem_allocated = 0;
 	size_t m_mem_freed = 0;
+	/** Memory released by foreign threads, not yet accounted in m_mem_used and m_mem_freed */
+	std::atomic<size_t> m_mem_freed_remotely;
+	/** Large objects memory allocated by foreign threads, not accounted in m_mem_used and m_mem_allocated */
+	std::atomic<size_t> m_mem_allocated_remotely;
+
+	bool m_trackLatency;
+	LatencyHistogram m_allocationLatency[static_cast<size_t>(LatencyTier::Count)];
+	LatencyHistogram m_deallocationLatency[static_cast<size_t>(LatencyTier::Count)];
+
+	/** Thread that created the Memory Manager. It is the only one allowed to allocate small objects */
+	const std::thread::id m_ownerThread;
 
 	//TODO : Refactor allocator instances. Maybe making a common allocator interface?
 	/** Allocator for SmallObjects */
 	SmallObjAllocator m_smallObjAllocator;
-	/** Allocator for LargeObjects. Large objects are identified by a size_t > MAX_SMALL_OBJ_SIZE*/
-	FreeListAllocator m_freeListAllocator;
+	/** Allocators for LargeObjects. Large objects are identified by a size_t > MAX_SMALL_OBJ_SIZE*/
+	LargeObjArenas m_largeObjArenas;
 
 	/** 
 	 *  Internal hash map. It is used to track every AllocationType::Collection request. 
 	 *  Its goal is to store the allocated size as a map entry, using its memory address as key.
 	 */
-	std::map<void*, size_t, std::less<void*>, Mallocator<std::pair<void*, size_t>>> m_arrayAllocationMap;
+	using ArrayAllocationMap = std::map<void*, size_t, std::less<void*>, Mallocator<std::pair<void* const, size_t>>>;
+	ArrayAllocationMap m_arrayAllocationMap;
+
+	/** Unsized release handed over by a foreign thread, the owner looks up its Collection size */
+	struct RemoteFree
+	{
+		RemoteFree* next;
+		void* ptr;
+	};
+	std::atomic<RemoteFree*> mp_remoteFrees{ nullptr };
 };
 
+template <typename T>
+inline void* ShirosMemoryManager::Allocate()
+{
+	constexpr size_t BlockSize = SmallObjAllocator::GetBlockSize(sizeof(T));
+
+	if constexpr (BlockSize <= MAX_SMALL_OBJECT_SIZE && alignof(T) <= alignof(std::max_align_t))
+	{
+		//threshold from creation params may be lower than the default one. Foreign threads take the generic path, which routes them
+		if (CanBeHandledWithSmallObjAllocator(sizeof(T)) && std::this_thread::get_id() == m_ownerThread && !m_trackLatency)
+		{
+			m_mem_used += BlockSize;
+			m_mem_allocated += BlockSize;
+			return m_smallObjAllocator.Allocate<BlockSize>();
+		}
+	}
+
+	return Allocate(sizeof(T), AllocationType::Single, alignof(T));
+}
+
+template <typename T>
+inline void ShirosMemoryManager::Deallocate(void* ptr)
+{
+	constexpr size_t BlockSize = SmallObjAllocator::GetBlockSize(sizeof(T));
+
+	if constexpr (BlockSize <= MAX_SMALL_OBJECT_SIZE && alignof(T) <= alignof(std::max_align_t))
+	{
+		if (ptr && CanBeHandledWithSmallObjAllocator(sizeof(T)) && std::this_thread::get_id() == m_ownerThread && !m_trackLatency)
+		{
+			m_smallObjAllocator.Deallocate<BlockSize>(ptr);
+			m_mem_used -= BlockSize;
+			m_mem_freed += BlockSize;
+			return;
+		}
+	}
+
+	Deallocate(ptr, sizeof(T));
+}
+
 inline void* operator new(size_t ObjSize, size_t Alignment, char const* function, char const* file, unsigned long line)
 {
 #ifdef MM_DEBUG
@@ -111,6 +283,19 @@ inline void _Delete<void>(void* ptr, size_t Size, char const* function, char con
 	}
 }
 
+template <typename T>
+inline void _DeleteT(T* ptr, char const* function, char const* file, unsigned long line)
+{
+#ifdef MM_DEBUG
+	cout << "Requested deallocation of address " << ptr << " requested by line " << line << " in function " << function << " in file " << file << endl;
+#endif
+	if (ptr)
+	{
+		ptr->~T();
+		ShirosMemoryManager::Get().Deallocate<T>(static_cast<void*>(ptr));
+	}
+}
+
 inline void* operator new[](size_t ObjSize, size_t Alignment, char const* function, char const* file, unsigned long line)
 {
 #ifdef MM_DEBUG
@@ -168,6 +353,9 @@ inline void _Free(void* ptr, size_t ObjSize, char const* function, char const* f
 #define MM_NEW(ALIGNMENT) new(ALIGNMENT, __FUNCTION__, __FILE__, __LINE__)
 #define MM_DELETE(PTR, SIZE) _Delete(PTR, SIZE, __FUNCTION__, __FILE__, __LINE__)
 
+#define MM_NEW_T(T) new(ShirosMemoryManager::Get().Allocate<T>()) T
+#define MM_DELETE_T(PTR) _DeleteT(PTR, __FUNCTION__, __FILE__, __LINE__)
+
 #define MM_NEW_A(T, LENGTH) new(alignof(T), __FUNCTION__, __FILE__, __LINE__) T[LENGTH]
 #define MM_DELETE_A(PTR, LENGTH) _DeleteArr(PTR, LENGTH, __FUNCTION__, __FILE__, __LINE__)
 
@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "ShirosMemoryResource.h"
+
+ShirosMemoryResource& ShirosMemoryResource::Get()
+{
+	static ShirosMemoryResource resource;
+	return resource;
+}
+
+size_t ShirosMemoryResource::GetRequestSize(size_t bytes, size_t alignment) const
+{
+	const size_t maxSmallObjectSize = ShirosMemoryManager::GetMaxSmallObjectSize();
+
+	//SmallObjAllocator blocks are aligned at most to max_align_t, over-aligned requests must be served by FreeListAllocator
+	if (alignment > alignof(std::max_align_t))
+	{
+		return bytes > maxSmallObjectSize ? bytes : maxSmallObjectSize + 1;
+	}
+
+	//chunks are aligned to max_align_t, so blocks whose size is a multiple of alignment are all aligned
+	if (bytes <= maxSmallObjectSize)
+	{
+		return (bytes + alignment - 1) & ~(alignment - 1);
+	}
+
+	return bytes;
+}
+
+void* ShirosMemoryResource::do_allocate(size_t bytes, size_t alignment)
+{
+	void* p_res = ShirosMemoryManager::Get().Allocate(GetRequestSize(bytes, alignment), ShirosMemoryManager::AllocationType::Single, alignment);
+	if (!p_res) { throw std::bad_alloc(); }
+	return p_res;
+}
+
+void ShirosMemoryResource::do_deallocate(void* ptr, size_t bytes, size_t alignment)
+{
+	ShirosMemoryManager::Get().Deallocate(ptr, GetRequestSize(bytes, alignment));
+}
+
+bool ShirosMemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	//every ShirosMemoryResource allocates from the same Memory Manager
+	return dynamic_cast<const ShirosMemoryResource*>(&other) != nullptr;
+}
+
+ShirosPoolResource::ShirosPoolResource(size_t BlockSize, size_t ChunkSize /* = DEFAULT_CHUNK_SIZE */, std::pmr::memory_resource* Upstream /* = &ShirosMemoryResource::Get() */)
+	: m_allocator(ChunkSize, BlockSize),
+	mp_upstream(Upstream)
+{
+	assert(mp_upstream);
+}
+
+ShirosPoolResource::~ShirosPoolResource()
+{
+	release();
+}
+
+void ShirosPoolResource::release()
+{
+	m_allocator.Release();
+}
+
+bool ShirosPoolResource::CanBeHandledWithPool(size_t bytes, size_t alignment) const
+{
+	const size_t blockSize = m_allocator.GetBlockSize();
+	return bytes <= blockSize && alignment <= alignof(std::max_align_t) && blockSize % alignment == 0;
+}
+
+void* ShirosPoolResource::do_allocate(size_t bytes, size_t alignment)
+{
+	if (CanBeHandledWithPool(bytes, alignment))
+	{
+		return m_allocator.Allocate();
+	}
+	return mp_upstream->allocate(bytes, alignment);
+}
+
+void ShirosPoolResource::do_deallocate(void* ptr, size_t bytes, size_t alignment)
+{
+	if (CanBeHandledWithPool(bytes, alignment))
+	{
+		m_allocator.Deallocate(ptr);
+		return;
+	}
+	mp_upstream->deallocate(ptr, bytes, alignment);
+}
+
+bool ShirosPoolResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+ShirosArenaResource::ShirosArenaResource(size_t InitialBufferSize /* = DEFAULT_CHUNK_SIZE */, std::pmr::memory_resource* Upstream /* = &ShirosMemoryResource::Get() */)
+	: mp_upstream(Upstream),
+	m_nextBufferSize(InitialBufferSize > sizeof(BufferHeader) ? InitialBufferSize : DEFAULT_CHUNK_SIZE)
+{
+	assert(mp_upstream);
+}
+
+ShirosArenaResource::~ShirosArenaResource()
+{
+	release();
+}
+
+void ShirosArenaResource::release()
+{
+	while (mp_buffers)
+	{
+		BufferHeader* next = mp_buffers->next;
+		mp_upstream->deallocate(mp_buffers, mp_buffers->size, alignof(std::max_align_t));
+		mp_buffers = next;
+	}
+	mp_current = mp_end = nullptr;
+}
+
+void* ShirosArenaResource::do_allocate(size_t bytes, size_t alignment)
+{
+	void* p_res = mp_current;
+	size_t space = static_cast<size_t>(mp_end - mp_current);
+
+	if (!mp_current || !std::align(alignment, bytes, p_res, space))
+	{
+		//current buffer is exhausted, request a new one big enough to host the aligned request
+		const size_t requiredSize = sizeof(BufferHeader) + bytes + alignment;
+		const size_t bufferSize = requiredSize > m_nextBufferSize ? requiredSize : m_nextBufferSize;
+
+		BufferHeader* buffer = static_cast<BufferHeader*>(mp_upstream->allocate(bufferSize, alignof(std::max_align_t)));
+		buffer->next = mp_buffers;
+		buffer->size = bufferSize;
+		mp_buffers = buffer;
+
+		mp_current = reinterpret_cast<unsigned char*>(buffer) + sizeof(BufferHeader);
+		mp_end = reinterpret_cast<unsigned char*>(buffer) + bufferSize;
+		m_nextBufferSize = bufferSize * 2;
+
+		p_res = mp_current;
+		space = static_cast<size_t>(mp_end - mp_current);
+		p_res = std::align(alignment, bytes, p_res, space);
+		assert(p_res);
+	}
+
+	mp_current = static_cast<unsigned char*>(p_res) + bytes;
+	return p_res;
+}
+
+void ShirosArenaResource::do_deallocate(void* /*ptr*/, size_t /*bytes*/, size_t /*alignment*/)
+{
+	//monotonic: memory is given back only on release
+}
+
+bool ShirosArenaResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
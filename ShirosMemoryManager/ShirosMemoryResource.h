@@ -0,0 +1,96 @@
+#pragma once
+#include <memory_resource>
+#include "ShirosMemoryManager.h"
+#include "FixedAllocator.h"
+
+/**
+ * std::pmr::memory_resource backed by ShirosMemoryManager.
+ * Deallocation is always sized, so no lookup in the internal array allocation map is ever performed
+ */
+class ShirosMemoryResource : public std::pmr::memory_resource
+{
+public:
+	/** All instances share the same Memory Manager, this one can be used as default upstream */
+	static ShirosMemoryResource& Get();
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+	/** Size effectively requested to the Memory Manager, it must be the same on allocation and deallocation */
+	size_t GetRequestSize(size_t bytes, size_t alignment) const;
+};
+
+/**
+ * std::pmr::memory_resource serving a single size class with a dedicated FixedAllocator.
+ * Requests that do not fit the size class are forwarded to the upstream resource
+ */
+class ShirosPoolResource : public std::pmr::memory_resource
+{
+public:
+	explicit ShirosPoolResource(size_t BlockSize, size_t ChunkSize = DEFAULT_CHUNK_SIZE, std::pmr::memory_resource* Upstream = &ShirosMemoryResource::Get());
+	~ShirosPoolResource();
+
+	/** Prevent copy for this class */
+	ShirosPoolResource(const ShirosPoolResource&) = delete;
+	ShirosPoolResource& operator=(const ShirosPoolResource&) = delete;
+
+	/** Release all the chunks, every block allocated from the pool becomes invalid */
+	void release();
+	inline std::pmr::memory_resource* upstream_resource() const { return mp_upstream; }
+	inline size_t GetBlockSize() const { return m_allocator.GetBlockSize(); }
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+	bool CanBeHandledWithPool(size_t bytes, size_t alignment) const;
+
+	FixedAllocator m_allocator;
+	std::pmr::memory_resource* mp_upstream;
+};
+
+/**
+ * Monotonic std::pmr::memory_resource. Memory is bumped out of buffers requested to the upstream resource,
+ * deallocation is a no-op and everything is given back at once on release or destruction
+ */
+class ShirosArenaResource : public std::pmr::memory_resource
+{
+public:
+	explicit ShirosArenaResource(size_t InitialBufferSize = DEFAULT_CHUNK_SIZE, std::pmr::memory_resource* Upstream = &ShirosMemoryResource::Get());
+	~ShirosArenaResource();
+
+	/** Prevent copy for this class */
+	ShirosArenaResource(const ShirosArenaResource&) = delete;
+	ShirosArenaResource& operator=(const ShirosArenaResource&) = delete;
+
+	/** Give back all the buffers to the upstream resource */
+	void release();
+	inline std::pmr::memory_resource* upstream_resource() const { return mp_upstream; }
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+	/** Header placed at the start of each buffer requested to upstream */
+	struct BufferHeader
+	{
+		BufferHeader* next;
+		size_t size;
+	};
+
+	std::pmr::memory_resource* mp_upstream;
+	/** Last buffer requested to upstream, buffers are linked from the newest to the oldest */
+	BufferHeader* mp_buffers = nullptr;
+	/** Bump pointer inside the current buffer */
+	unsigned char* mp_current = nullptr;
+	unsigned char* mp_end = nullptr;
+	/** Size of the next buffer requested to upstream. It grows geometrically */
+	size_t m_nextBufferSize;
+};
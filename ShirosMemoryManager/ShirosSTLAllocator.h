@@ -2,6 +2,10 @@
 #include "ShirosMemoryManager.h"
 #include <stdlib.h> // size_t, malloc, free
 #include <new> // bad_alloc, bad_array_new_length
+#include <type_traits> // true_type, false_type
+#include <utility> // forward
+#include <memory> // allocation_result
+#include <limits> // numeric_limits
 
 template <typename T>
 class ShirosSTLAllocator
@@ -15,6 +19,12 @@ public:
 	using const_reference = const T&;
 	using value_type = T;
 
+	/** Stateless: every instance allocates from the same Memory Manager, so any instance can release memory of any other */
+	using is_always_equal = std::true_type;
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::false_type;
+
 	explicit ShirosSTLAllocator() = default;
 
 	/*Rebind a ShirosSTLAllocator<T> to a ShirosSTLAllocator<U> */
@@ -27,38 +37,78 @@ public:
 	inline const_pointer address(const_reference ref) const { return &ref; }
 	inline size_type max_size() const throw() { return std::numeric_limits<size_type>::max() / sizeof(value_type); }
 
-	inline pointer allocate(size_type n, std::allocator<void>::const_pointer hint = 0)
+	inline pointer allocate(size_type n, const void* hint = 0)
 	{
+		//node based containers always request a single element, size class is resolved at compile time
+		if (n == 1)
+		{
+			void* const pv = ShirosMemoryManager::Get().Allocate<T>();
+			if (!pv) { throw std::bad_alloc(); }
+			return static_cast<pointer>(pv);
+		}
 		if (n == 0) { return nullptr; }
 		if (n > std::numeric_limits<size_type>::max() / sizeof(T)) {
 			throw std::bad_array_new_length();
 		}
-		void* const pv = MM_NEW_A(T, n);
-		if (!pv) { throw std::bad_alloc(); }
-		return static_cast<pointer>(pv);
+		return AllocateBytes(n * sizeof(T));
 	}
 
-	inline void deallocate(pointer p, size_type n)
+#ifdef __cpp_lib_allocate_at_least
+	using allocation_result = std::allocation_result<pointer, size_type>;
+#else
+	struct allocation_result
 	{
-		MM_DELETE_A(p, n);
-	}
+		pointer ptr;
+		size_type count;
+	};
+#endif
 
-	inline void construct(pointer p, const T& val)
+	/** C++23 allocate_at_least: count is the number of T fitting the block, the container can grow into it without reallocating */
+	inline allocation_result allocate_at_least(size_type n)
 	{
-		new(static_cast<void*>(p)) T(val); //object construction only
+		if (n == 0) { return { nullptr, 0 }; }
+		if (n > std::numeric_limits<size_type>::max() / sizeof(T)) {
+			throw std::bad_array_new_length();
+		}
+		const ShirosMemoryManager::AllocationResult res = ShirosMemoryManager::Get().AllocateAtLeast(n * sizeof(T), alignof(T));
+		if (!res.ptr) { throw std::bad_alloc(); }
+		return { static_cast<pointer>(res.ptr), res.count / sizeof(T) };
 	}
 
-	inline void construct(pointer p)
+	/** n can be either the one requested or the count returned by allocate_at_least */
+	inline void deallocate(pointer p, size_type n)
 	{
-		new(static_cast<void*>(p)) T();  //object construction only
+		//containers always give back the same n used for allocation, no lookup in the array allocation map is needed
+		if (n == 1)
+		{
+			ShirosMemoryManager::Get().Deallocate<T>(static_cast<void*>(p));
+			return;
+		}
+		ShirosMemoryManager::Get().Deallocate(static_cast<void*>(p), n * sizeof(T));
 	}
 
-	inline void destroy(pointer p)
+	template <class U, class... Args>
+	inline void construct(U* p, Args&&... args)
 	{
-		p->~T(); //object destruction only
+		new(static_cast<void*>(p)) U(std::forward<Args>(args)...); //object construction only
 	}
 
-	inline bool operator==(const ShirosSTLAllocator& a) { return &a == this; }
-	inline bool operator!=(const ShirosSTLAllocator& a) { return !operator==(a); }
+	template <class U>
+	inline void destroy(U* p)
+	{
+		p->~U(); //object destruction only
+	}
 
+private:
+	inline pointer AllocateBytes(size_type bytes)
+	{
+		void* const pv = ShirosMemoryManager::Get().Allocate(bytes, ShirosMemoryManager::AllocationType::Single, alignof(T));
+		if (!pv) { throw std::bad_alloc(); }
+		return static_cast<pointer>(pv);
+	}
 };
+
+template <class T, class U>
+inline bool operator==(const ShirosSTLAllocator<T>&, const ShirosSTLAllocator<U>&) { return true; }
+template <class T, class U>
+inline bool operator!=(const ShirosSTLAllocator<T>&, const ShirosSTLAllocator<U>&) { return false; }
@@ -1,87 +1,202 @@
 #include "pch.h"
 #include "SmallObjAllocator.h"
 
-namespace {
-	auto FixedAllocatorComparator = [](const FixedAllocator& Allocator, size_t bytes) { return Allocator.GetBlockSize() < bytes; };
+SmallObjAllocator::SmallObjAllocator(size_t chunkSize, size_t maxObjectSize /* = MAX_SMALL_OBJECT_SIZE */, FixedAllocator::FreeTracking freeTracking /* = FixedAllocator::FreeTracking::FREE_LIST */,
+	const ChunkRetentionPolicy& retention /* = ChunkRetentionPolicy() */, RetentionPolicyProvider retentionProvider /* = nullptr */, bool hugePages /* = false */,
+	bool chunkColouring /* = false */)
+	: m_Pool(std::max(maxObjectSize, MIN_SMALL_OBJECT_SIZE) + 1), //one slot for each block size, slot 0 is never used
+	m_chunkSize(chunkSize),
+	m_freeTracking(freeTracking),
+	m_retention(retention),
+	m_retentionProvider(retentionProvider),
+	m_slabProvider(chunkSize > 0 ? chunkSize : DEFAULT_CHUNK_SIZE),
+	m_hugePages(hugePages),
+	m_chunkColouring(chunkColouring)
+{
+
 }
 
-SmallObjAllocator::SmallObjAllocator(size_t chunkSize)
-	: m_chunkSize(chunkSize)
+SmallObjAllocator::~SmallObjAllocator()
 {
+	ReleaseAllocators();
+}
 
+FixedAllocator* SmallObjAllocator::GetAllocator(size_t blockSize)
+{
+	assert(blockSize < m_Pool.size() && "Requested size is not a small object");
+
+	FixedAllocator* allocator = m_Pool[blockSize].load(std::memory_order_relaxed);
+	if (!allocator)
+	{
+		//allocator that manage this size is nowhere to be found, create a new one that'll do the work
+		Mallocator<FixedAllocator> FixedAllocatorMallocator;
+		allocator = FixedAllocatorMallocator.allocate(1);
+		const ChunkRetentionPolicy retention = m_retentionProvider ? m_retentionProvider(blockSize) : m_retention;
+		FixedAllocatorMallocator.construct(allocator, FixedAllocator(m_chunkSize, blockSize, m_freeTracking, retention, m_hugePages ? &m_slabProvider : nullptr, m_chunkColouring));
+		//publish it, foreign threads may read this slot concurrently
+		m_Pool[blockSize].store(allocator, std::memory_order_release);
+	}
+	return allocator;
 }
 
-SmallObjAllocator::~SmallObjAllocator()
+void SmallObjAllocator::ReleaseAllocators()
 {
+	Mallocator<FixedAllocator> FixedAllocatorMallocator;
 	AllocatorPool::iterator it = m_Pool.begin();
 	for (; it != m_Pool.end(); ++it)
 	{
-		it->Release();
+		FixedAllocator* allocator = it->exchange(nullptr, std::memory_order_relaxed);
+		if (allocator)
+		{
+			allocator->Release();
+			FixedAllocatorMallocator.destroy(allocator);
+			FixedAllocatorMallocator.deallocate(allocator, 1);
+		}
 	}
 }
 
 void* SmallObjAllocator::Allocate(size_t bytes, size_t& OutAllocatedMemory)
 {
-	OutAllocatedMemory = bytes; //we allocate just the right amount of memory
+	const size_t blockSize = GetBlockSize(bytes);
+	OutAllocatedMemory = blockSize; //we allocate just the right amount of memory
 
-	//check if we already allocated an allocator, and if this one manage Chunk of the desired size
-	if (!m_lastAllocatorUsedForAllocation || m_lastAllocatorUsedForAllocation->GetBlockSize() != bytes)
-	{
-		//find the correct allocator in list
-		AllocatorPool::iterator it = std::lower_bound(m_Pool.begin(), m_Pool.end(), bytes, FixedAllocatorComparator);
+	FixedAllocator* allocator = GetAllocator(blockSize);
 
-		// if the allocator that manage this size_t is nowhere to be found 
-		// or the one we found does not manage the exact sizeof bytes
-		// then insert a new Allocator that'll do the work
-		if (it == m_Pool.end() || it->GetBlockSize() != bytes)
-		{
-			it = m_Pool.insert(it, FixedAllocator(m_chunkSize, bytes));
-			m_lastAllocatorUsedForDeallocation = &*m_Pool.begin();
-		}
-		
-		//either we found an allocator or we're using the one we just inserted
-		m_lastAllocatorUsedForAllocation = &*it;
-	}
-
-	m_totMemoryAllocated -= m_lastAllocatorUsedForAllocation->GetTotalAllocatedMemory(); //remove current memory occupied by it that does not consider new allocation
-	void* p_res = m_lastAllocatorUsedForAllocation->Allocate();
-	m_totMemoryAllocated += m_lastAllocatorUsedForAllocation->GetTotalAllocatedMemory(); //add new value for memory occupied by it also considering new allocation
-	return p_res;
+	return allocator->Allocate();
 }
 
 size_t SmallObjAllocator::Deallocate(void* p_obj, size_t size_obj)
 {
-	//check if the last time we deallocated something from an allocator, and if that allocator is of the desired size
-	//if it is, then use that one
-	if (m_lastAllocatorUsedForDeallocation && m_lastAllocatorUsedForDeallocation->GetBlockSize() == size_obj)
-	{
-		m_lastAllocatorUsedForDeallocation->Deallocate(p_obj);
-		return size_obj;
-	}
+	const size_t blockSize = GetBlockSize(size_obj);
+	assert(blockSize < m_Pool.size());
+
 	//find the allocator used to allocate the object requested to release
-	AllocatorPool::iterator it = std::lower_bound(m_Pool.begin(), m_Pool.end(), size_obj, FixedAllocatorComparator);
-	//assert the allocator exists and it is of the right size
+	FixedAllocator* allocator = m_Pool[blockSize].load(std::memory_order_relaxed);
+	//assert the allocator exists
 	//it MUST be impossible to delete an object that was previously allocated using our Allocator!
-	assert(it != m_Pool.end());
-	assert(it->GetBlockSize() == size_obj);
-	m_lastAllocatorUsedForDeallocation = &*it;
-	m_lastAllocatorUsedForDeallocation->Deallocate(p_obj);
+	assert(allocator);
+
+	allocator->Deallocate(p_obj);
 
-	return size_obj; //we deallocate just the right amount
+	return blockSize; //we deallocate just the right amount
+}
+
+size_t SmallObjAllocator::AllocateBatch(size_t bytes, size_t Count, void** OutBlocks, size_t& OutAllocatedMemory)
+{
+	const size_t blockSize = GetBlockSize(bytes);
+	OutAllocatedMemory = blockSize;
+
+	FixedAllocator* allocator = GetAllocator(blockSize);
+
+	return allocator->AllocateBatch(OutBlocks, Count);
+}
+
+size_t SmallObjAllocator::DeallocateBatch(void* const* Blocks, size_t Count, size_t size_obj)
+{
+	const size_t blockSize = GetBlockSize(size_obj);
+	assert(blockSize < m_Pool.size());
+
+	FixedAllocator* allocator = m_Pool[blockSize].load(std::memory_order_relaxed);
+	assert(allocator);
+
+	allocator->DeallocateBatch(Blocks, Count);
+
+	return blockSize;
+}
+
+size_t SmallObjAllocator::DeallocateRemote(void* p_obj, size_t size_obj)
+{
+	const size_t blockSize = GetBlockSize(size_obj);
+	assert(blockSize < m_Pool.size());
+
+	//pairs with the release store performed by the owner when the allocator was created
+	FixedAllocator* allocator = m_Pool[blockSize].load(std::memory_order_acquire);
+	assert(allocator && "Remote deallocation of a block never allocated by this SmallObjAllocator");
+
+	allocator->DeallocateRemote(p_obj);
+
+	return blockSize;
 }
 
 void SmallObjAllocator::Reset()
 {
-	m_totMemoryAllocated = 0;
+	ReleaseAllocators();
+}
 
-	m_lastAllocatorUsedForDeallocation = nullptr;
-	m_lastAllocatorUsedForAllocation = nullptr;
+size_t SmallObjAllocator::GetTotalAllocatedMemory() const
+{
+	size_t totMemoryAllocated = 0;
+	AllocatorPool::const_iterator it = m_Pool.begin();
+	for (; it != m_Pool.end(); ++it)
+	{
+		const FixedAllocator* allocator = it->load(std::memory_order_relaxed);
+		if (allocator)
+		{
+			totMemoryAllocated += allocator->GetTotalAllocatedMemory();
+		}
+	}
+	return totMemoryAllocated;
+}
 
+void SmallObjAllocator::TrimEmptyChunks()
+{
 	AllocatorPool::iterator it = m_Pool.begin();
 	for (; it != m_Pool.end(); ++it)
 	{
-		it->Release();
+		FixedAllocator* allocator = it->load(std::memory_order_relaxed);
+		if (allocator)
+		{
+			allocator->TrimEmptyChunks();
+		}
+	}
+}
+
+ChunkStats SmallObjAllocator::GetChunkStats(size_t bytes) const
+{
+	const size_t blockSize = GetBlockSize(bytes);
+	assert(blockSize < m_Pool.size());
+
+	const FixedAllocator* allocator = m_Pool[blockSize].load(std::memory_order_relaxed);
+	return allocator ? allocator->GetChunkStats() : ChunkStats();
+}
+
+ChunkStats SmallObjAllocator::GetChunkStats() const
+{
+	ChunkStats totStats;
+	AllocatorPool::const_iterator it = m_Pool.begin();
+	for (; it != m_Pool.end(); ++it)
+	{
+		const FixedAllocator* allocator = it->load(std::memory_order_relaxed);
+		if (allocator)
+		{
+			const ChunkStats stats = allocator->GetChunkStats();
+			totStats.created += stats.created;
+			totStats.destroyed += stats.destroyed;
+			totStats.live += stats.live;
+			totStats.empty += stats.empty;
+		}
+	}
+	return totStats;
+}
+
+MemoryFootprint SmallObjAllocator::GetMemoryFootprint() const
+{
+	MemoryFootprint footprint;
+	footprint.metadataBytes = m_Pool.capacity() * sizeof(AllocatorPool::value_type);
+
+	AllocatorPool::const_iterator it = m_Pool.begin();
+	for (; it != m_Pool.end(); ++it)
+	{
+		const FixedAllocator* allocator = it->load(std::memory_order_relaxed);
+		if (allocator)
+		{
+			footprint += allocator->GetMemoryFootprint();
+		}
 	}
 
-	m_Pool.clear();
+	//pieces handed out as chunks are accounted by their FixedAllocators
+	footprint.freeBytes += m_slabProvider.GetFreePiecesCount() * m_slabProvider.GetPieceSize();
+	//slab headers and slab tails too short for a piece
+	footprint.wastedBytes += m_slabProvider.GetMappedBytes() - m_slabProvider.GetPiecesCount() * m_slabProvider.GetPieceSize();
+	return footprint;
 }
@@ -1,16 +1,23 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <cassert>
 #include "FixedAllocator.h"
 #include "Mallocator.h"
 
 constexpr size_t MAX_SMALL_OBJECT_SIZE = 128;
+/** Min block size handled. Every block must be able to host the link used by the remote free list */
+constexpr size_t MIN_SMALL_OBJECT_SIZE = sizeof(void*);
 
+/** Chooses the empty chunk retention policy of a size class, given its block size */
+using RetentionPolicyProvider = ChunkRetentionPolicy(*)(size_t blockSize);
 
 class SmallObjAllocator
 {
 public:
-	SmallObjAllocator(size_t chunkSize);
+	SmallObjAllocator(size_t chunkSize, size_t maxObjectSize = MAX_SMALL_OBJECT_SIZE, FixedAllocator::FreeTracking freeTracking = FixedAllocator::FreeTracking::FREE_LIST,
+		const ChunkRetentionPolicy& retention = ChunkRetentionPolicy(), RetentionPolicyProvider retentionProvider = nullptr, bool hugePages = false, bool chunkColouring = false);
 	~SmallObjAllocator();
 
 	/**
@@ -38,22 +45,106 @@ public:
 	 *
 	 */
 	size_t Deallocate(void* p_obj, size_t size_obj);
+	/**
+	 *	Allocates Count blocks for SmallObjects of the same size
+	 *
+	 *@param bytes - Requested allocation size of each block
+	 *@param Count - Number of blocks to allocate
+	 *@param OutBlocks - Array of at least Count elements receiving the allocated addresses
+	 *@param OutAllocatedMemory - Effective memory size allocated for each block
+	 *
+	 *@return The number of allocated blocks
+	 *
+	 */
+	size_t AllocateBatch(size_t bytes, size_t Count, void** OutBlocks, size_t& OutAllocatedMemory);
+	/**
+	 *	Deallocates Count blocks for SmallObjects of the same size
+	 *
+	 *@param Blocks - Addresses to deallocate
+	 *@param Count - Number of addresses to deallocate
+	 *@param size_obj - Requested size of each block to be deallocated
+	 *
+	 *@return The memory size deallocated for each block
+	 *
+	 */
+	size_t DeallocateBatch(void* const* Blocks, size_t Count, size_t size_obj);
+	/**
+	 *	Thread-safe. Deallocates memory for SmallObjects from a thread that does not own this allocator
+	 *
+	 *@param p_obj - Pointer to memory address from which deallocate
+	 *@param size_obj - Requested size to be deallocated
+	 *
+	 *@return The size that will be given back to the owning FixedAllocator
+	 *
+	 */
+	size_t DeallocateRemote(void* p_obj, size_t size_obj);
 
 	void Reset();
-	inline size_t GetTotalAllocatedMemory() const { return m_totMemoryAllocated; }
+	/** Apply the retention policy of every size class, releasing the empty chunks in excess */
+	void TrimEmptyChunks();
+	/** Chunk counters of the size class serving requests of the given size */
+	ChunkStats GetChunkStats(size_t bytes) const;
+	/** Chunk counters summed over all the size classes */
+	ChunkStats GetChunkStats() const;
+	/** Memory reserved by all the FixedAllocators chunks. Computed on demand to keep it out of allocation paths */
+	size_t GetTotalAllocatedMemory() const;
+	/** Memory of every size class, the allocator pool and the huge page slabs chunks are carved from */
+	MemoryFootprint GetMemoryFootprint() const;
+
+	/** Block size effectively used to serve a request of the given size */
+	static constexpr size_t GetBlockSize(size_t bytes) { return bytes < MIN_SMALL_OBJECT_SIZE ? MIN_SMALL_OBJECT_SIZE : bytes; }
+
+	/** Allocation for a block size known at compile time. The FixedAllocator is reached with a single indexed load */
+	template <size_t BlockSize>
+	inline void* Allocate()
+	{
+		static_assert(BlockSize >= MIN_SMALL_OBJECT_SIZE, "Block size must be computed with GetBlockSize");
+		assert(BlockSize < m_Pool.size());
+
+		FixedAllocator* allocator = m_Pool[BlockSize].load(std::memory_order_relaxed);
+		if (!allocator)
+		{
+			allocator = GetAllocator(BlockSize);
+		}
+		return allocator->Allocate();
+	}
+
+	/** Deallocation for a block size known at compile time */
+	template <size_t BlockSize>
+	inline void Deallocate(void* p_obj)
+	{
+		static_assert(BlockSize >= MIN_SMALL_OBJECT_SIZE, "Block size must be computed with GetBlockSize");
+		assert(BlockSize < m_Pool.size());
+
+		FixedAllocator* allocator = m_Pool[BlockSize].load(std::memory_order_relaxed);
+		assert(allocator);
+		allocator->Deallocate(p_obj);
+	}
 
 	/** Prevent copy for this class */
 	SmallObjAllocator(const SmallObjAllocator&) = delete;
 	SmallObjAllocator& operator=(const SmallObjAllocator&) = delete;
 private:
-	using AllocatorPool = std::vector<FixedAllocator, Mallocator<FixedAllocator>>;
+	/** Find the FixedAllocator managing blocks of the given size, creating it if needed */
+	FixedAllocator* GetAllocator(size_t blockSize);
+	void ReleaseAllocators();
+
+	/**
+	 * FixedAllocators indexed by block size. Entries are created lazily and never move,
+	 * so foreign threads can safely look them up while the owner keeps allocating
+	 */
+	using AllocatorPool = std::vector<std::atomic<FixedAllocator*>, Mallocator<std::atomic<FixedAllocator*>>>;
 	AllocatorPool m_Pool;
 	
-	FixedAllocator* m_lastAllocatorUsedForAllocation = nullptr;
-	FixedAllocator* m_lastAllocatorUsedForDeallocation = nullptr;
 	size_t m_chunkSize;
-	
-	//DEBUG
-	size_t m_totMemoryAllocated = 0;
+	FixedAllocator::FreeTracking m_freeTracking;
+	/** Retention policy of the size classes not customised by the provider */
+	ChunkRetentionPolicy m_retention;
+	RetentionPolicyProvider m_retentionProvider;
+	/** Huge page slabs chunks are carved from. Used only when huge pages are requested */
+	ChunkSlabProvider m_slabProvider;
+	const bool m_hugePages;
+	/** Shift the blocks of each new chunk within its slack, see FixedAllocator */
+	const bool m_chunkColouring;
 };
 
@@ -0,0 +1,37 @@
+#pragma once
+
+/**
+ * Static tracepoints on the allocator slow paths, under the "shiro_mm" provider.
+ * On Linux, when <sys/sdt.h> is available (systemtap-sdt-dev), every tracepoint is a USDT probe:
+ * a single nop in the code plus an ELF note, so it costs nothing until a tracer attaches to it.
+ * Elsewhere, or when SHIRO_MM_DISABLE_TRACEPOINTS is defined, tracepoints expand to nothing and their arguments are not evaluated.
+ *
+ * Probes:
+ *   chunk_create(blockSize, chunkIndex, chunksCount)     FixedAllocator appended a chunk
+ *   chunk_release(blockSize, chunkIndex, chunksCount)    FixedAllocator gave a chunk back
+ *   freelist_find_start(size, alignment)                 FreeListAllocator free block search begins
+ *   freelist_find_done(size, block)                      search ended, block is 0 when none fits
+ *   freelist_coalesce(block, blockSize, merged)          a freed block was merged with merged neighbours
+ *   array_map_insert(ptr, size, entries)                 Collection allocation recorded in the array map
+ *
+ * Examples:
+ *   bpftrace -e 'usdt:./Client:shiro_mm:chunk_create { @[arg0] = count(); }'
+ *   bpftrace -e 'usdt:./Client:shiro_mm:freelist_find_start { @s[tid] = nsecs; }
+ *                usdt:./Client:shiro_mm:freelist_find_done /@s[tid]/ { @ns = hist(nsecs - @s[tid]); delete(@s[tid]); }'
+ *   perf probe -x ./Client sdt_shiro_mm:chunk_release && perf record -e sdt_shiro_mm:chunk_release -a
+ */
+
+#if !defined(SHIRO_MM_DISABLE_TRACEPOINTS) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHIRO_MM_TRACEPOINTS_ENABLED
+#endif
+#endif
+
+#ifdef SHIRO_MM_TRACEPOINTS_ENABLED
+#define SHIRO_MM_TRACE2(name, a, b) DTRACE_PROBE2(shiro_mm, name, a, b)
+#define SHIRO_MM_TRACE3(name, a, b, c) DTRACE_PROBE3(shiro_mm, name, a, b, c)
+#else
+#define SHIRO_MM_TRACE2(name, a, b) ((void)0)
+#define SHIRO_MM_TRACE3(name, a, b, c) ((void)0)
+#endif
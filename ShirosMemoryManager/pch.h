@@ -13,6 +13,8 @@
 #include <vector>
 #include <cassert>
 #include <algorithm>
+#include <cstring>
+#include <atomic>
 
 using std::cout;
 using std::endl;